@@ -0,0 +1,641 @@
+#include "bimap.h"
+#include "frozen_bimap.h"
+#include "mapped_bimap.h"
+#include "compact_bimap.h"
+#include "concurrent_bimap.h"
+#include "persistent_bimap.h"
+
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+using int_bimap = bimap<uint32_t, uint32_t>;
+using avl_bimap = bimap<uint32_t, uint32_t, std::less<uint32_t>, std::less<uint32_t>,
+                        std::allocator<splay_tree<uint32_t, uint32_t>>, avl_policy>;
+using hashed_bimap = bimap<uint32_t, uint32_t, std::less<uint32_t>, std::less<uint32_t>,
+                           std::allocator<splay_tree<uint32_t, uint32_t>>, splay_policy,
+                           hash_index<std::hash<uint32_t>, std::hash<uint32_t>>>;
+using counting_bimap = bimap<uint32_t, uint32_t, std::less<uint32_t>, std::less<uint32_t>,
+                             std::allocator<splay_tree<uint32_t, uint32_t>>, splay_policy,
+                             hash_index<>, counting_stats>;
+using compact_int_bimap = compact_bimap<uint32_t, uint32_t>;
+using persistent_int_bimap = persistent_bimap<uint32_t, uint32_t>;
+
+constexpr uint32_t seed = 1488228;
+constexpr size_t queries_count = 1 << 16;
+
+enum order { random_order, sorted_order, reversed_order };
+enum distribution { uniform, zipf };
+
+std::vector<int64_t> const sizes = {1000, 10000, 100000, 1000000, 10000000};
+
+/**
+ * n pairs, lefts and rights are both shuffled even numbers of [0, 2n),
+ * so odd keys are misses spread over the whole tree
+ */
+struct dataset {
+  explicit dataset(size_t n) : lefts(n), rights(n) {
+    std::mt19937 e(seed);
+    for (size_t i = 0; i < n; i++) {
+      lefts[i] = rights[i] = 2 * i;
+    }
+    std::shuffle(lefts.begin(), lefts.end(), e);
+    std::shuffle(rights.begin(), rights.end(), e);
+  }
+
+  std::vector<uint32_t> lefts;
+  std::vector<uint32_t> rights;
+};
+
+/**
+ * datasets and maps built from them are shared between benchmarks,
+ * building a map of 1e7 pairs takes longer than most measurements
+ */
+dataset const &shared_dataset(size_t n) {
+  static std::map<size_t, std::unique_ptr<dataset>> cache;
+  auto &res = cache[n];
+  if (!res) {
+    res = std::make_unique<dataset>(n);
+  }
+  return *res;
+}
+
+template <typename Bimap = int_bimap>
+Bimap &shared_bimap(size_t n) {
+  static std::map<size_t, std::unique_ptr<Bimap>> cache;
+  auto &res = cache[n];
+  if (!res) {
+    res = std::make_unique<Bimap>();
+    dataset const &data = shared_dataset(n);
+    for (size_t i = 0; i < n; i++) {
+      res->insert(data.lefts[i], data.rights[i]);
+    }
+  }
+  return *res;
+}
+
+/**
+ * present keys (even numbers of [0, 2n)) drawn uniformly or by Zipf law with s = 0.99 (approximated by
+ * inverting the continuous density), hot ranks are scattered over key space
+ */
+std::vector<uint32_t> make_queries(size_t n, distribution dist) {
+  std::mt19937 e(seed + 1);
+  std::vector<uint32_t> res(queries_count);
+
+  if (dist == uniform) {
+    std::uniform_int_distribution<uint32_t> key(0, n - 1);
+    for (auto &q : res) {
+      q = 2 * key(e);
+    }
+    return res;
+  }
+
+  double const s = 0.99;
+  double const top = std::pow(double(n) + 1, 1 - s) - 1;
+  std::uniform_real_distribution<double> u(0, 1);
+  for (auto &q : res) {
+    auto rank = static_cast<uint64_t>(std::pow(1 + u(e) * top, 1 / (1 - s))) - 1;
+    // multiplicative hashing spreads neighbouring ranks, n is not a power
+    // of two, so collisions only slightly flatten the distribution
+    q = static_cast<uint32_t>(2 * (std::min<uint64_t>(rank, n - 1) * 2654435761u % n));
+  }
+  return res;
+}
+
+std::vector<uint32_t> ordered_keys(size_t n, order ord) {
+  std::vector<uint32_t> res(n);
+  for (size_t i = 0; i < n; i++) {
+    res[i] = 2 * i;
+  }
+  if (ord == random_order) {
+    std::shuffle(res.begin(), res.end(), std::mt19937(seed));
+  } else if (ord == reversed_order) {
+    std::reverse(res.begin(), res.end());
+  }
+  return res;
+}
+
+template <typename Bimap>
+void BM_insert(benchmark::State &state) {
+  size_t n = state.range(0);
+  std::vector<uint32_t> lefts = ordered_keys(n, order(state.range(1)));
+  std::vector<uint32_t> const &rights = shared_dataset(n).rights;
+
+  for (auto _ : state) {
+    auto b = std::make_unique<Bimap>();
+    for (size_t i = 0; i < n; i++) {
+      b->insert(lefts[i], rights[i]);
+    }
+    state.PauseTiming();
+    b.reset();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK_TEMPLATE(BM_insert, int_bimap)
+    ->ArgsProduct({sizes, {random_order, sorted_order, reversed_order}})
+    ->ArgNames({"n", "order"})
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_insert, avl_bimap)
+    ->ArgsProduct({sizes, {random_order, sorted_order, reversed_order}})
+    ->ArgNames({"n", "order"})
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_insert, hashed_bimap)
+    ->ArgsProduct({sizes, {random_order, sorted_order, reversed_order}})
+    ->ArgNames({"n", "order"})
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_insert, compact_int_bimap)
+    ->ArgsProduct({sizes, {random_order, sorted_order, reversed_order}})
+    ->ArgNames({"n", "order"})
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_insert, persistent_int_bimap)
+    ->ArgsProduct({sizes, {random_order, sorted_order, reversed_order}})
+    ->ArgNames({"n", "order"})
+    ->Unit(benchmark::kMillisecond);
+
+/**
+ * appends in sorted order with end() as hint
+ */
+template <typename Bimap>
+void BM_insert_hinted(benchmark::State &state) {
+  size_t n = state.range(0);
+  std::vector<uint32_t> const &rights = shared_dataset(n).rights;
+
+  for (auto _ : state) {
+    auto b = std::make_unique<Bimap>();
+    for (size_t i = 0; i < n; i++) {
+      b->insert(b->end_left(), 2 * i, rights[i]);
+    }
+    state.PauseTiming();
+    b.reset();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK_TEMPLATE(BM_insert_hinted, int_bimap)
+    ->ArgsProduct({sizes})
+    ->ArgNames({"n"})
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_insert_hinted, avl_bimap)
+    ->ArgsProduct({sizes})
+    ->ArgNames({"n"})
+    ->Unit(benchmark::kMillisecond);
+
+/**
+ * sorted inserts leave a path of depth n: the first lookup splays all of it
+ * and destroy walks it
+ */
+void BM_sorted_stress(benchmark::State &state) {
+  size_t n = state.range(0);
+
+  for (auto _ : state) {
+    auto b = std::make_unique<int_bimap>();
+    for (uint32_t i = 0; i < n; i++) {
+      b->insert(i, i);
+    }
+    benchmark::DoNotOptimize(b->find_left(0));
+    benchmark::DoNotOptimize(b->find_right(n / 2));
+    b.reset();
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_sorted_stress)->ArgsProduct({sizes})->ArgNames({"n"})->Unit(benchmark::kMillisecond);
+
+template <typename Bimap>
+void BM_find_left(benchmark::State &state) {
+  size_t n = state.range(0);
+  Bimap &b = shared_bimap<Bimap>(n);
+  std::vector<uint32_t> queries = make_queries(n, distribution(state.range(1)));
+  // odd keys are missing
+  uint32_t shift = state.range(2) ? 0 : 1;
+
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(b.find_left(queries[i++ % queries_count] + shift));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_TEMPLATE(BM_find_left, int_bimap)
+    ->ArgsProduct({sizes, {uniform, zipf}, {1, 0}})
+    ->ArgNames({"n", "zipf", "hit"});
+// balanced trees don't adapt to skew, but reads don't write either
+BENCHMARK_TEMPLATE(BM_find_left, avl_bimap)
+    ->ArgsProduct({sizes, {uniform, zipf}, {1, 0}})
+    ->ArgNames({"n", "zipf", "hit"});
+// the price of leaving instrumentation on
+BENCHMARK_TEMPLATE(BM_find_left, counting_bimap)
+    ->ArgsProduct({sizes, {uniform, zipf}, {1, 0}})
+    ->ArgNames({"n", "zipf", "hit"});
+BENCHMARK_TEMPLATE(BM_find_left, hashed_bimap)
+    ->ArgsProduct({sizes, {uniform, zipf}, {1, 0}})
+    ->ArgNames({"n", "zipf", "hit"});
+BENCHMARK_TEMPLATE(BM_find_left, compact_int_bimap)
+    ->ArgsProduct({sizes, {uniform, zipf}, {1, 0}})
+    ->ArgNames({"n", "zipf", "hit"});
+
+void BM_frozen_find_left(benchmark::State &state) {
+  size_t n = state.range(0);
+  static std::map<size_t, std::unique_ptr<frozen_bimap<uint32_t, uint32_t>>> cache;
+  auto &f = cache[n];
+  if (!f) {
+    f = std::make_unique<frozen_bimap<uint32_t, uint32_t>>(shared_bimap(n));
+  }
+  std::vector<uint32_t> queries = make_queries(n, distribution(state.range(1)));
+  uint32_t shift = state.range(2) ? 0 : 1;
+
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(f->find_left(queries[i++ % queries_count] + shift));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_frozen_find_left)
+    ->ArgsProduct({sizes, {uniform, zipf}, {1, 0}})
+    ->ArgNames({"n", "zipf", "hit"});
+
+void BM_find_right(benchmark::State &state) {
+  size_t n = state.range(0);
+  int_bimap &b = shared_bimap(n);
+  std::vector<uint32_t> queries = make_queries(n, distribution(state.range(1)));
+  uint32_t shift = state.range(2) ? 0 : 1;
+
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(b.find_right(queries[i++ % queries_count] + shift));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_find_right)
+    ->ArgsProduct({sizes, {uniform, zipf}, {1, 0}})
+    ->ArgNames({"n", "zipf", "hit"});
+
+void BM_at_left(benchmark::State &state) {
+  size_t n = state.range(0);
+  int_bimap &b = shared_bimap(n);
+  std::vector<uint32_t> queries = make_queries(n, distribution(state.range(1)));
+
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(b.at_left(queries[i++ % queries_count]));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_at_left)->ArgsProduct({sizes, {uniform, zipf}})->ArgNames({"n", "zipf"});
+
+/**
+ * every thread inserts its own keys and looks up keys of all threads,
+ * one of four operations is an insert
+ */
+void BM_concurrent_insert_at_left(benchmark::State &state) {
+  static std::unique_ptr<concurrent_bimap<uint32_t, uint32_t>> b;
+  if (state.thread_index() == 0) {
+    b = std::make_unique<concurrent_bimap<uint32_t, uint32_t>>();
+  }
+
+  uint32_t threads = state.threads(), inserted = 0;
+  std::mt19937 e(seed + state.thread_index());
+  for (auto _ : state) {
+    if (e() % 4 == 0) {
+      uint32_t key = inserted++ * threads + state.thread_index();
+      b->insert(key, key);
+    } else {
+      benchmark::DoNotOptimize(b->find_left(e() % (inserted * threads + 1)));
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+
+  if (state.thread_index() == 0) {
+    b.reset();
+  }
+}
+BENCHMARK(BM_concurrent_insert_at_left)->ThreadRange(1, 8)->UseRealTime();
+
+/**
+ * batch is the number of keys per at_left_batch call, items are keys
+ */
+void BM_at_left_batch(benchmark::State &state) {
+  size_t n = state.range(0);
+  size_t batch = state.range(2);
+  int_bimap &b = shared_bimap(n);
+  std::vector<uint32_t> queries = make_queries(n, distribution(state.range(1)));
+  std::vector<uint32_t> out(batch);
+
+  size_t i = 0;
+  for (auto _ : state) {
+    auto first = queries.begin() + (i++ * batch) % queries_count;
+    b.at_left_batch(first, first + batch, out.begin());
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetItemsProcessed(state.iterations() * batch);
+}
+BENCHMARK(BM_at_left_batch)
+    ->ArgsProduct({sizes, {uniform, zipf}, {64, 4096}})
+    ->ArgNames({"n", "zipf", "batch"});
+
+void BM_nth_right(benchmark::State &state) {
+  size_t n = state.range(0);
+  int_bimap &b = shared_bimap(n);
+  std::mt19937 e(seed + 1);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(b.nth_right(e() % n));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_nth_right)->ArgsProduct({sizes})->ArgNames({"n"});
+
+/**
+ * moved pairs with the greatest lefts are split off and joined back,
+ * items are moved pairs
+ */
+void BM_split_join(benchmark::State &state) {
+  size_t n = state.range(0);
+  size_t moved = std::min<size_t>(state.range(1), n);
+  int_bimap &b = shared_bimap(n);
+  uint32_t key = *b.nth_left(n - moved);
+
+  for (auto _ : state) {
+    int_bimap upper = b.split_left(key);
+    b.join(std::move(upper));
+  }
+  state.SetItemsProcessed(state.iterations() * moved);
+}
+BENCHMARK(BM_split_join)
+    ->ArgsProduct({sizes, {16, 1024, 65536}})
+    ->ArgNames({"n", "moved"});
+
+void BM_lower_bound_left(benchmark::State &state) {
+  size_t n = state.range(0);
+  int_bimap &b = shared_bimap(n);
+  std::vector<uint32_t> queries = make_queries(n, distribution(state.range(1)));
+
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(b.lower_bound_left(queries[i++ % queries_count]));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_lower_bound_left)
+    ->ArgsProduct({sizes, {uniform, zipf}})
+    ->ArgNames({"n", "zipf"});
+
+void BM_iterate_left(benchmark::State &state) {
+  size_t n = state.range(0);
+  int_bimap &b = shared_bimap(n);
+
+  for (auto _ : state) {
+    uint64_t sum = 0;
+    for (auto it = b.begin_left(); it != b.end_left(); ++it) {
+      sum += *it;
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_iterate_left)->ArgsProduct({sizes})->ArgNames({"n"})->Unit(benchmark::kMillisecond);
+
+void BM_scan_left(benchmark::State &state) {
+  size_t n = state.range(0);
+  int_bimap &b = shared_bimap(n);
+
+  for (auto _ : state) {
+    uint64_t sum = 0;
+    for (uint32_t left : b.scan_left()) {
+      sum += left;
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_scan_left)->ArgsProduct({sizes})->ArgNames({"n"})->Unit(benchmark::kMillisecond);
+
+void BM_iterate_left_flip(benchmark::State &state) {
+  size_t n = state.range(0);
+  int_bimap &b = shared_bimap(n);
+
+  for (auto _ : state) {
+    uint64_t sum = 0;
+    for (auto it = b.begin_left(); it != b.end_left(); ++it) {
+      sum += *it.flip();
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_iterate_left_flip)
+    ->ArgsProduct({sizes})
+    ->ArgNames({"n"})
+    ->Unit(benchmark::kMillisecond);
+
+void BM_erase_left(benchmark::State &state) {
+  size_t n = state.range(0);
+  size_t const erased = std::min<size_t>(n / 2, 1000);
+  std::vector<uint32_t> queries = make_queries(n, uniform);
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto b = std::make_unique<int_bimap>(shared_bimap(n));
+    state.ResumeTiming();
+
+    for (size_t i = 0; i < erased; i++) {
+      benchmark::DoNotOptimize(b->erase_left(queries[i]));
+    }
+
+    state.PauseTiming();
+    b.reset();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * erased);
+}
+BENCHMARK(BM_erase_left)->ArgsProduct({sizes})->ArgNames({"n"})->Unit(benchmark::kMicrosecond);
+
+void BM_erase_left_range(benchmark::State &state) {
+  size_t n = state.range(0);
+  // percent of the map erased by one call
+  size_t width = n * state.range(1) / 100;
+  uint32_t from = n / 2;
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto b = std::make_unique<int_bimap>(shared_bimap(n));
+    state.ResumeTiming();
+
+    b->erase_left(b->lower_bound_left(from), b->lower_bound_left(from + 2 * width));
+
+    state.PauseTiming();
+    b.reset();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * width);
+}
+BENCHMARK(BM_erase_left_range)
+    ->ArgsProduct({sizes, {1, 50}})
+    ->ArgNames({"n", "percent"})
+    ->Unit(benchmark::kMicrosecond);
+
+void BM_copy(benchmark::State &state) {
+  size_t n = state.range(0);
+  int_bimap const &b = shared_bimap(n);
+
+  for (auto _ : state) {
+    auto copy = std::make_unique<int_bimap>(b);
+    state.PauseTiming();
+    copy.reset();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_copy)->ArgsProduct({sizes})->ArgNames({"n"})->Unit(benchmark::kMillisecond);
+
+void BM_equal(benchmark::State &state) {
+  size_t n = state.range(0);
+  int_bimap const &b = shared_bimap(n);
+  int_bimap const copy(b);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(b == copy);
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_equal)->ArgsProduct({sizes})->ArgNames({"n"})->Unit(benchmark::kMillisecond);
+
+void BM_load(benchmark::State &state) {
+  size_t n = state.range(0);
+  std::stringstream saved;
+  shared_bimap(n).save(saved);
+  std::string data = saved.str();
+
+  for (auto _ : state) {
+    std::stringstream stream(data);
+    auto loaded = std::make_unique<int_bimap>(int_bimap::load(stream));
+    state.PauseTiming();
+    loaded.reset();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_load)->ArgsProduct({sizes})->ArgNames({"n"})->Unit(benchmark::kMillisecond);
+
+void BM_from_pairs(benchmark::State &state) {
+  size_t n = state.range(0);
+  dataset const &data = shared_dataset(n);
+  std::vector<std::pair<uint32_t, uint32_t>> pairs;
+  for (size_t i = 0; i < n; i++) {
+    pairs.emplace_back(data.lefts[i], data.rights[i]);
+  }
+
+  for (auto _ : state) {
+    auto b = std::make_unique<int_bimap>(int_bimap::from_pairs(pairs, state.range(1)));
+    state.PauseTiming();
+    b.reset();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_from_pairs)
+    ->ArgsProduct({sizes, {1, 4, 32}})
+    ->ArgNames({"n", "threads"})
+    ->Unit(benchmark::kMillisecond);
+
+/**
+ * saved bimap in the temporary directory, removed when the benchmark ends
+ * however it ends
+ */
+struct temp_file {
+  explicit temp_file(std::string const &name)
+      : path((std::filesystem::temp_directory_path() / name).string()) {}
+  temp_file(temp_file const &) = delete;
+  temp_file &operator=(temp_file const &) = delete;
+  ~temp_file() {
+    std::remove(path.c_str());
+  }
+
+  std::string path;
+};
+
+void BM_mapped_at_left(benchmark::State &state) {
+  size_t n = state.range(0);
+  temp_file file("bimap_bench_" + std::to_string(n) + ".bin");
+  shared_bimap(n).save_to_file(file.path);
+  mapped_bimap<uint32_t, uint32_t> m(file.path);
+  std::vector<uint32_t> queries = make_queries(n, distribution(state.range(1)));
+
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(m.at_left(queries[i++ % queries_count]));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_mapped_at_left)->ArgsProduct({sizes, {uniform, zipf}})->ArgNames({"n", "zipf"});
+
+/**
+ * baseline: pair of std::map, as in bimap_randomized.compare_to_two_maps
+ */
+struct two_maps {
+  bool insert(uint32_t l, uint32_t r) {
+    if (left_view.count(l) || right_view.count(r)) {
+      return false;
+    }
+    left_view.emplace(l, r);
+    right_view.emplace(r, l);
+    return true;
+  }
+
+  std::map<uint32_t, uint32_t> left_view;
+  std::map<uint32_t, uint32_t> right_view;
+};
+
+void BM_two_maps_insert(benchmark::State &state) {
+  size_t n = state.range(0);
+  std::vector<uint32_t> lefts = ordered_keys(n, order(state.range(1)));
+  std::vector<uint32_t> const &rights = shared_dataset(n).rights;
+
+  for (auto _ : state) {
+    auto m = std::make_unique<two_maps>();
+    for (size_t i = 0; i < n; i++) {
+      m->insert(lefts[i], rights[i]);
+    }
+    state.PauseTiming();
+    m.reset();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_two_maps_insert)
+    ->ArgsProduct({sizes, {random_order, sorted_order, reversed_order}})
+    ->ArgNames({"n", "order"})
+    ->Unit(benchmark::kMillisecond);
+
+void BM_two_maps_find_left(benchmark::State &state) {
+  size_t n = state.range(0);
+  dataset const &data = shared_dataset(n);
+  two_maps m;
+  for (size_t i = 0; i < n; i++) {
+    m.insert(data.lefts[i], data.rights[i]);
+  }
+  std::vector<uint32_t> queries = make_queries(n, distribution(state.range(1)));
+  uint32_t shift = state.range(2) ? 0 : 1;
+
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(m.left_view.find(queries[i++ % queries_count] + shift));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_two_maps_find_left)
+    ->ArgsProduct({sizes, {uniform, zipf}, {1, 0}})
+    ->ArgNames({"n", "zipf", "hit"});
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -2,20 +2,64 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <tuple>
 #include <utility>
 #include <functional>
+#include <iterator>
 #include <type_traits>
 #include <stdexcept>
+#include <memory>
+#include <optional>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <istream>
+#include <ostream>
+#include <fstream>
+#include <string>
 #include "splay_tree.h"
+#include "tree_policy.h"
+#include "hash_index.h"
+#include "bimap_format.h"
+#include "parallel.h"
+#include "stats_policy.h"
+
+/**
+ * true for comparators and hashes which accept any comparable key type,
+ * like std::less<>
+ */
+template <typename T, typename = void>
+struct is_transparent : std::false_type {};
+template <typename T>
+struct is_transparent<T, std::void_t<typename T::is_transparent>> : std::true_type {};
 
 template <typename Left, typename Right,
-    typename CompareLeft = std::less<Left>, typename CompareRight = std::less<Right>>
+    typename CompareLeft = std::less<Left>, typename CompareRight = std::less<Right>,
+    typename Allocator = std::allocator<splay_tree<Left, Right>>,
+    typename TreePolicy = splay_policy,
+    typename HashIndex = hash_index<>,
+    typename Stats = no_stats>
 struct bimap {
   using left_t = Left;
   using right_t = Right;
+  using allocator_type = Allocator;
+  using tree_policy = TreePolicy;
+  using hash_index_policy = HashIndex;
+  using stats_policy = Stats;
 
 private:
-  using splay_tree_t = splay_tree<left_t, right_t>;
+  static constexpr bool self_adjusting = TreePolicy::self_adjusting;
+
+  // nodes carry the data of the tree policy, node<Tag, T> below means them
+  using node_data = typename TreePolicy::node_data;
+  template <typename Tag, typename T>
+  using node = ::node<Tag, T, node_data>;
+
+  using splay_tree_t = splay_tree<left_t, right_t, node_data>;
+  using node_allocator_t =
+      typename std::allocator_traits<Allocator>::template rebind_alloc<splay_tree_t>;
+  using node_traits = std::allocator_traits<node_allocator_t>;
 
   static constexpr node<left_tag, left_t>* (*get_node_l)(splay_tree_t*) =
       &get_node<left_tag, left_t, right_t, left_t>;
@@ -27,8 +71,22 @@ private:
   static constexpr splay_tree_t *(*get_splay_r)(node<right_tag, right_t >*) =
     &get_splay<right_tag, left_t, right_t>;
 
-  template <typename Tag, typename T>
-  bool less(T const &a, T const &b) const {
+  template <typename Tag>
+  using value_t = std::conditional_t<std::is_same_v<Tag, left_tag>, left_t, right_t>;
+  template <typename Tag>
+  using node_t = node<Tag, value_t<Tag>>;
+  template <typename Tag>
+  using opposite_t = std::conditional_t<std::is_same_v<Tag, left_tag>, right_tag, left_tag>;
+
+  /**
+   * index of the Tag side in the counters of Stats
+   */
+  template <typename Tag>
+  static constexpr std::size_t side_of = std::is_same_v<Tag, right_tag>;
+
+  template <typename Tag, typename A, typename B>
+  bool less(A const &a, B const &b) const {
+    counters.compare(side_of<Tag>);
     if constexpr (std::is_same_v<Tag, left_tag>) {
       return compare_left(a, b);
     } else {
@@ -36,63 +94,93 @@ private:
     }
   }
 
-  template <typename Tag, typename T>
-  bool equal(T const &a, T const &b) const {
+  template <typename Tag, typename A, typename B>
+  bool equal(A const &a, B const &b) const {
     return !less<Tag>(a, b) && !less<Tag>(b, a);
   }
 
   /**
-   * invariant for all functions, except split: tree_left and tree_right stay correct,
+   * invariant for all functions: tree_left and tree_right stay correct,
    */
 
 
   /**
+   * descends from the root t and splays the last visited node, so an
+   * unsuccessful search is paid for by splaying too
    * @return node with equal value if tree with root t, contains it, nullptr otherwise
    */
-  template <typename Tag, typename T>
-  node<Tag, T> *find(node<Tag, T> *t, T const &value) const {
-    if (!t) {
-      return t;
+  template <typename Tag, typename T, typename K>
+  node<Tag, T> *find(node<Tag, T> *t, K const &value) const {
+    node<Tag, T> *last = nullptr;
+    std::size_t depth = 0;
+
+    while (t) {
+      if (last) {
+        depth++;
+      }
+      last = t;
+      if (less<Tag>(t->value, value)) {
+        t = t->right;
+      } else if (less<Tag>(value, t->value)) {
+        t = t->left;
+      } else {
+        break;
+      }
     }
 
-    if (equal<Tag>(t->value, value)) {
-      return set_tree_root(t);
+    if (last) {
+      counters.find_depth(side_of<Tag>, depth);
+      set_tree_root(last);
     }
+    return t;
+  }
 
-    if (less<Tag, T>(t->value, value)) {
-      if (!t->right) {
-        return nullptr;
-      }
-      return find(t->right, value);
-    } else {
-      if (!t->left) {
-        return nullptr;
-      }
-      return find(t->left, value);
-    }
+  /**
+   * descends once from the root, or by finger search from finger, and
+   * splays the last visited node
+   * @return node equal to value or the last visited one, below which value
+   * belongs (the new root for splay trees), nullptr if tree is empty
+   */
+  template <typename Tag, typename K>
+  node_t<Tag> *find_closest(K const &value, node_t<Tag> *finger = nullptr) const {
+    node_t<Tag> *found = walk_finger<Tag>(finger, value);
+    return set_tree_root(found ? found : finger);
   }
 
   /**
-   * @return was element inserted or not
+   * links new_node next to closest, returned by find_closest for its value
    */
   template <typename Tag, typename T>
-  bool insert(node<Tag, T> *new_node) const {
-    node<Tag, T> *t = get_root<Tag, T>();
-
-    if (!t) {
-      set_tree_root(new_node);
-      return true;
+  void link_closest(node<Tag, T> *closest, node<Tag, T> *new_node) const {
+    if constexpr (self_adjusting) {
+      link_at_root(new_node);
+    } else {
+      TreePolicy::link(get_root<Tag, T>(), closest, new_node,
+                       closest && less<Tag>(closest->value, new_node->value));
     }
+  }
 
-    std::pair<node<Tag, T>*, node<Tag, T>*> tmp = split<Tag>(new_node->value);
-
-    if (tmp.first && equal<Tag>(tmp.first->value, new_node->value)) {
-      merge(tmp.first, tmp.second);
-      return false;
+  /**
+   * makes new_node the root, current root has to be a neighbour of its value
+   * (see find_closest)
+   */
+  template <typename Tag, typename T>
+  void link_at_root(node<Tag, T> *new_node) const {
+    node<Tag, T> *root = get_root<Tag, T>();
+
+    if (root) {
+      if (less<Tag>(root->value, new_node->value)) {
+        new_node->left = root;
+        new_node->right = root->right;
+        root->right = nullptr;
+      } else {
+        new_node->right = root;
+        new_node->left = root->left;
+        root->left = nullptr;
+      }
+      root->update_size();
     }
-
-    new_node->left = tmp.first;
-    new_node->right = tmp.second;
+    new_node->update_size();
 
     if (new_node->left) {
       new_node->left->parent = new_node;
@@ -101,25 +189,21 @@ private:
       new_node->right->parent = new_node;
     }
 
-    set_tree_root(new_node);
-    return true;
+    new_node->parent = nullptr;
+    get_root<Tag, T>() = new_node;
   }
 
   /**
- * @return was element removed or not
- */
+   * removes t from its tree, t stays allocated
+   */
   template <typename Tag, typename T>
-  bool remove(T const &value) const {
-    node<Tag, T> *t = get_root<Tag, T>();
-
-    if (!t) {
-      return false;
+  void unlink(node<Tag, T> *t) const {
+    if constexpr (!self_adjusting) {
+      TreePolicy::unlink(get_root<Tag, T>(), t);
+      return;
     }
 
-    t = find(t, value);
-    if (!equal<Tag>(t->value, value)) {
-      return false;
-    }
+    set_tree_root(t);
 
     if (t->left) {
       t->left->parent = nullptr;
@@ -129,7 +213,6 @@ private:
     }
 
     merge(t->left, t->right);
-    return true;
   }
 
   /**
@@ -140,6 +223,9 @@ private:
     if (!t) {
       return t;
     }
+    if constexpr (!self_adjusting) {
+      return count_step(walk_next(t));
+    }
 
     t = set_tree_root(t);
 
@@ -148,44 +234,26 @@ private:
     }
 
     node<Tag, T> *tmp = t->right;
+    std::size_t depth = 1;
     while (tmp->left) {
       tmp = tmp->left;
+      depth++;
     }
 
+    counters.step_depth(side_of<Tag>, depth);
     return set_tree_root(tmp);
   }
 
   /**
-   * @return if there is node with node->value > value,
-   * return it, nullptr otherwise
+   * @return previous element, the last one for end()
    */
   template <typename Tag, typename T>
-  node<Tag, T> *next(T const &value) const {
-    node<Tag, T> *t = get_root<Tag, T>();
-
+  node<Tag, T> *prev(node<Tag, T> *t) const {
     if (!t) {
-      return t;
-    }
-
-    while (true) {
-      if (less<Tag, T>(t->value, value) || equal<Tag>(t->value, value)) {
-        if (!t->right) {
-          return next<Tag>(t);
-        }
-        t = t->right;
-      } else {
-        if (!t->left) {
-          return set_tree_root(t);
-        }
-        t = t->left;
-      }
+      return set_tree_root(count_step(walk_max(get_root<Tag, T>())));
     }
-  }
-
-  template <typename Tag, typename T>
-  std::pair<node<Tag, T>*, node<Tag, T>*> prev(node<Tag, T> *t) const {
-    if (!t) {
-      return t;
+    if constexpr (!self_adjusting) {
+      return count_step(walk_prev(t));
     }
 
     t = set_tree_root(t);
@@ -195,221 +263,1101 @@ private:
     }
 
     node<Tag, T> *tmp = t->left;
+    std::size_t depth = 1;
     while (tmp->right) {
       tmp = tmp->right;
+      depth++;
     }
 
+    counters.step_depth(side_of<Tag>, depth);
     return set_tree_root(tmp);
   }
 
+  /**
+   * records the depth of t, where an iterator step arrived, in the step
+   * histogram
+   */
   template <typename Tag, typename T>
-  void destroy(node<Tag, T> *t) {
-    if (!t) {
-      return;
+  node<Tag, T> *count_step(node<Tag, T> *t) const {
+    if constexpr (Stats::enabled) {
+      if (t) {
+        counters.step_depth(side_of<Tag>, depth_of(t));
+      }
     }
+    return t;
+  }
 
-    destroy(t->left);
-    destroy(t->right);
-    delete get_splay<Tag, left_t, right_t>(t);
+  template <typename Tag, typename T>
+  static std::size_t depth_of(node<Tag, T> const *t) {
+    std::size_t res = 0;
+    for (; t->parent; t = t->parent) {
+      res++;
+    }
+    return res;
   }
 
+  /**
+   * number of nodes on the longest path down from t, walks the tree along
+   * parent links without a stack
+   */
   template <typename Tag, typename T>
-  node<Tag, T> *zig(node<Tag, T> *t) const{
-    if (less<Tag>(t->value, t->parent->value)) {
-      t->parent->left = t->right;
-      if (t->right) {
-        t->right->parent = t->parent;
+  static std::size_t tree_height(node<Tag, T> const *t) {
+    std::size_t res = 0;
+    std::size_t depth = 0;
+    node<Tag, T> const *from = t ? t->parent : nullptr;
+    while (t) {
+      node<Tag, T> const *to;
+      if (from == t->parent) {
+        res = std::max(res, ++depth);
+        to = t->left ? t->left : t->right ? t->right : t->parent;
+      } else if (from == t->left && t->right) {
+        to = t->right;
+      } else {
+        to = t->parent;
       }
+      if (to == t->parent) {
+        depth--;
+      }
+      from = t;
+      t = to;
+    }
+    return res;
+  }
 
-      t->right = t->parent;
-    } else {
-      t->parent->right = t->left;
+  /**
+   * frees every pair of the tree with root t, rotates left children up
+   * instead of recursing, so the depth of the tree does not matter
+   */
+  template <typename Tag, typename T>
+  void destroy(node<Tag, T> *t) {
+    while (t) {
       if (t->left) {
-        t->left->parent = t->parent;
+        node<Tag, T> *l = t->left;
+        t->left = l->right;
+        l->right = t;
+        t = l;
+      } else {
+        node<Tag, T> *r = t->right;
+        destroy_node(get_splay<Tag, left_t, right_t>(t));
+        t = r;
       }
-
-      t->left = t->parent;
     }
+  }
 
-    node<Tag, T> *tmp = t->parent->parent;
-    t->parent->parent = t;
-    t->parent = tmp;
+  template <typename... Args>
+  splay_tree_t *create_node(Args &&... args) {
+    splay_tree_t *res = node_traits::allocate(allocator, 1);
+    try {
+      node_traits::construct(allocator, res, std::forward<Args>(args)...);
+    } catch (...) {
+      node_traits::deallocate(allocator, res, 1);
+      throw;
+    }
+    return res;
+  }
 
-    return t;
+  void destroy_node(splay_tree_t *t) {
+    node_traits::destroy(allocator, t);
+    node_traits::deallocate(allocator, t, 1);
   }
 
-  template <typename Tag, typename T>
-  node<Tag, T> *splay(node<Tag, T> *t) const {
-    if (!t || !t->parent) {
-      return get_root<Tag, T>() = t;
+  template <typename Tag>
+  using hash_t = std::conditional_t<std::is_same_v<Tag, left_tag>,
+                                    typename HashIndex::left_hash, typename HashIndex::right_hash>;
+  template <typename Tag>
+  static constexpr bool hashed = !std::is_void_v<hash_t<Tag>>;
+  template <typename Tag>
+  using index_t = std::conditional_t<!std::is_void_v<hash_t<Tag>>,
+                                     node_hash_table<node_t<Tag>, hash_t<Tag>, node_allocator_t>,
+                                     no_hash_table>;
+
+  template <typename Tag>
+  auto &get_index() {
+    if constexpr (std::is_same_v<Tag, left_tag>) {
+      return index_left;
+    } else {
+      return index_right;
     }
-    if (!t->parent->parent) {
-      return get_root<Tag, T>() = zig(t);
+  }
+  template <typename Tag>
+  auto const &get_index() const {
+    if constexpr (std::is_same_v<Tag, left_tag>) {
+      return index_left;
+    } else {
+      return index_right;
     }
+  }
 
-    bool t_to_p = less<Tag>(t->value, t->parent->value);
-    bool p_to_pp = less<Tag>(t->parent->value, t->parent->parent->value);
-    if (t_to_p == p_to_pp) {
-      t->parent = zig(t->parent);
-      t = zig(t);
+  /**
+   * exact match through the hash index if the side has one and can hash K,
+   * through find (and so splaying) otherwise
+   */
+  template <typename Tag, typename K>
+  node_t<Tag> *lookup(K const &value) const {
+    counters.find(side_of<Tag>);
+    if constexpr (hashed<Tag> && (std::is_same_v<K, value_t<Tag>> ||
+                                  is_transparent<hash_t<Tag>>::value)) {
+      return get_index<Tag>().find(value, [this](value_t<Tag> const &a, K const &b) {
+        return equal<Tag>(a, b);
+      });
     } else {
-      t = zig(t);
-      t = zig(t);
+      return find(get_root<Tag, value_t<Tag>>(), value);
     }
-
-    return splay(t);
   }
 
   /**
-   * @return two trees, all elements in first tree <= value
+   * exact match which never restructures the trees
    */
-  template <typename Tag, typename T>
-  std::pair<node<Tag, T>*, node<Tag, T>*> split(T const &value) const {
-    node<Tag, T> *t = next<Tag>(value);
-    if (!t) {
-      return {get_root<Tag, T>(), t};
+  template <typename Tag, typename K>
+  node_t<Tag> *walk_lookup(K const &value) const {
+    if constexpr (hashed<Tag> && (std::is_same_v<K, value_t<Tag>> ||
+                                  is_transparent<hash_t<Tag>>::value)) {
+      return lookup<Tag>(value);
+    } else {
+      return walk_find<Tag>(value);
     }
+  }
 
-    node<Tag, T> *left_new = t->left;
-    t->left = nullptr;
+  /**
+   * makes room for size pairs in hash indices, called before trees change
+   */
+  void index_reserve(std::size_t size) {
+    if constexpr (hashed<left_tag>) {
+      index_left.reserve(size);
+    }
+    if constexpr (hashed<right_tag>) {
+      index_right.reserve(size);
+    }
+  }
 
-    if (left_new) {
-      left_new->parent = nullptr;
+  void index_insert(splay_tree_t *pair) noexcept {
+    if constexpr (hashed<left_tag>) {
+      index_left.insert(get_node_l(pair));
+    }
+    if constexpr (hashed<right_tag>) {
+      index_right.insert(get_node_r(pair));
     }
-    return {left_new, t};
   }
 
-  template <typename Tag, typename T>
-  node<Tag, T> *find_max(node<Tag, T> *t) const {
-    while (t->right) {
-      t = t->right;
+  void index_erase(splay_tree_t *pair) noexcept {
+    if constexpr (hashed<left_tag>) {
+      index_left.erase(get_node_l(pair));
     }
+    if constexpr (hashed<right_tag>) {
+      index_right.erase(get_node_r(pair));
+    }
+  }
 
-    return set_tree_root(t);
+  /**
+   * indexes all pairs again, after trees are built wholesale
+   */
+  void rebuild_indices() {
+    if constexpr (hashed<left_tag> || hashed<right_tag>) {
+      index_reserve(tree_size);
+      if constexpr (hashed<left_tag>) {
+        index_left.clear();
+      }
+      if constexpr (hashed<right_tag>) {
+        index_right.clear();
+      }
+      for (node<left_tag, left_t> *t = walk_min(tree_left); t; t = walk_next(t)) {
+        index_insert(get_splay_l(t));
+      }
+    }
   }
 
-  template <typename Tag, typename T>
-  node<Tag, T> *find_min(node<Tag, T> *t) const {
-    while (t->left) {
-      t = t->left;
+  /**
+   * links size nodes, sorted by Tag side, into a perfectly balanced tree
+   * @return root of the built tree
+   */
+  template <typename Tag>
+  static node_t<Tag> *build_balanced(splay_tree_t *const *nodes, std::size_t size,
+                                     node_t<Tag> *parent) {
+    if (size == 0) {
+      return nullptr;
     }
 
-    return set_tree_root(t);
+    std::size_t mid = size / 2;
+    node_t<Tag> *t = nodes[mid];
+    t->parent = parent;
+    t->left = build_balanced<Tag>(nodes, mid, t);
+    t->right = build_balanced<Tag>(nodes + mid + 1, size - mid - 1, t);
+    TreePolicy::update(t);
+    return t;
   }
 
-  template <typename Tag, typename T>
-  void merge(node<Tag, T> *a, node<Tag, T> *b) const {
-    if (!a) {
-      set_tree_root(b);
+  /**
+   * copies shape of other's left tree and builds balanced right tree from one
+   * sorted pass, trees of other are only read
+   * on exception already cloned pairs are reachable from tree_left
+   */
+  void clone_trees(bimap const &other) {
+    node<left_tag, left_t> *src = other.tree_left;
+    if (!src) {
       return;
     }
-    if (!b) {
-      set_tree_root(a);
-      return;
+
+    std::unordered_map<splay_tree_t const *, splay_tree_t *> clones;
+    clones.reserve(other.tree_size);
+
+    node<left_tag, left_t> *dst = tree_left = get_node_l(create_node(*get_splay_l(src)));
+    static_cast<node_data &>(*dst) = *src;
+    dst->size = src->size;
+    clones.emplace(get_splay_l(src), get_splay_l(dst));
+    while (src) {
+      if (src->left && !dst->left) {
+        dst->left = get_node_l(create_node(*get_splay_l(src->left)));
+        dst->left->parent = dst;
+        src = src->left;
+        dst = dst->left;
+      } else if (src->right && !dst->right) {
+        dst->right = get_node_l(create_node(*get_splay_l(src->right)));
+        dst->right->parent = dst;
+        src = src->right;
+        dst = dst->right;
+      } else {
+        src = src->parent;
+        dst = dst->parent;
+        continue;
+      }
+      static_cast<node_data &>(*dst) = *src;
+      dst->size = src->size;
+      clones.emplace(get_splay_l(src), get_splay_l(dst));
     }
 
-    a = find_max(a);
-    a->right = b;
-    b->parent = a;
+    std::vector<splay_tree_t *> by_right;
+    by_right.reserve(other.tree_size);
+    for (node<right_tag, right_t> *t = walk_min(other.tree_right); t; t = walk_next(t)) {
+      by_right.push_back(clones.find(get_splay_r(t))->second);
+    }
+    tree_right = build_balanced<right_tag>(by_right.data(), by_right.size(), nullptr);
   }
 
-  template <typename Tag, typename T>
-  struct iterator {
-    // Элемент на который сейчас ссылается итератор.
-    // Разыменование итератора end_left() неопределено.
-    // Разыменование невалидного итератора неопределено.
-    T const &operator*() const {
-      return tree->value;
-    }
+  /**
+   * fills empty bimap from pairs sorted by left without searching the trees
+   */
+  template <typename InputIt>
+  void build_sorted(InputIt first, InputIt last) {
+    std::vector<splay_tree_t *> by_left;
+    try {
+      for (; first != last; ++first) {
+        auto &&p = *first;
+        by_left.push_back(nullptr);
+        by_left.back() = create_node(std::forward<decltype(p)>(p).first,
+                                     std::forward<decltype(p)>(p).second);
+
+        if (by_left.size() > 1 && !less<left_tag>(get_node_l(by_left[by_left.size() - 2])->value,
+                                                  get_node_l(by_left.back())->value)) {
+          throw std::invalid_argument(
+              "bimap::from_sorted - lefts are not strictly increasing");
+        }
+      }
 
-    // Переход к следующему по величине left'у.
-    // Инкремент итератора end_left() неопределен.
-    // Инкремент невалидного итератора неопределен.
-    iterator &operator++() {
-      tree = bmp->next<Tag, T>(tree);
-      return *this;
-    }
-    iterator operator++(int) {
-      node<Tag, T> *old = tree;
-      ++*this;
+      std::vector<splay_tree_t *> by_right(by_left);
+      std::sort(by_right.begin(), by_right.end(), [this](splay_tree_t *a, splay_tree_t *b) {
+        return less<right_tag>(get_node_r(a)->value, get_node_r(b)->value);
+      });
+      for (std::size_t i = 1; i < by_right.size(); i++) {
+        if (!less<right_tag>(get_node_r(by_right[i - 1])->value,
+                             get_node_r(by_right[i])->value)) {
+          throw std::invalid_argument("bimap::from_sorted - rights are not unique");
+        }
+      }
 
-      return {old, bmp};
+      tree_left = build_balanced<left_tag>(by_left.data(), by_left.size(), nullptr);
+      tree_right = build_balanced<right_tag>(by_right.data(), by_right.size(), nullptr);
+      tree_size = by_left.size();
+    } catch (...) {
+      for (splay_tree_t *t : by_left) {
+        if (t) {
+          destroy_node(t);
+        }
+      }
+      throw;
     }
+  }
 
-    // Переход к предыдущему по величине left'у.
-    // Декремент итератора begin_left() неопределен.
-    // Декремент невалидного итератора неопределен.
-    iterator &operator--() {
-      tree = bmp->prev<Tag, T>(tree);
-      return *this;
+  /**
+   * build_balanced with the halves of big trees built on their own threads
+   */
+  template <typename Tag>
+  static node_t<Tag> *build_balanced(splay_tree_t *const *nodes, std::size_t size,
+                                     node_t<Tag> *parent, unsigned threads) {
+    if (threads <= 1 || size < parallel_grain) {
+      return build_balanced<Tag>(nodes, size, parent);
     }
-    iterator operator--(int) {
-      node<Tag, T> *old = tree;
-      --*this;
 
-      return {old, bmp};
-    }
+    std::size_t mid = size / 2;
+    node_t<Tag> *t = nodes[mid];
+    t->parent = parent;
+    parallel_run(2, [&](unsigned i) {
+      if (i == 0) {
+        t->left = build_balanced<Tag>(nodes, mid, t, threads / 2);
+      } else {
+        t->right = build_balanced<Tag>(nodes + mid + 1, size - mid - 1, t, threads - threads / 2);
+      }
+    });
+    TreePolicy::update(t);
+    return t;
+  }
 
-    // left_iterator ссылается на левый элемент некоторой пары.
-    // Эта функция возвращает итератор на правый элемент той же пары.
-    // end_left().flip() возращает end_right().
-    // end_right().flip() возвращает end_left().
-    // flip() невалидного итератора неопределен.
+  /**
+   * fills empty bimap from pairs sorted by left, left_at(i) and right_at(i)
+   * are the i-th pair, and, for every right in increasing order, rank of
+   * its pair, so both trees are linked without sorting; checks the orders
+   * as it goes. Nodes are created on this thread, trees are linked on
+   * threads threads
+   */
+  template <typename LeftAt, typename RightAt>
+  void build_presorted(std::size_t count, LeftAt const &left_at, RightAt const &right_at,
+                       std::uint32_t const *ranks, unsigned threads = 1) {
+    std::vector<splay_tree_t *> by_left;
+    by_left.reserve(count);
+    try {
+      for (std::size_t i = 0; i < count; i++) {
+        by_left.push_back(create_node(left_at(i), right_at(i)));
+        if (i > 0 && !less<left_tag>(get_node_l(by_left[i - 1])->value, get_node_l(by_left[i])->value)) {
+          throw std::runtime_error("bimap::load - lefts are not strictly increasing");
+        }
+      }
 
-    auto flip() const {
-      if constexpr (std::is_same_v<Tag, left_tag>) {
-        return iterator<right_tag, right_t>(get_opposite<left_tag>(tree), bmp);
+      std::vector<splay_tree_t *> by_right(count);
+      for (std::size_t i = 0; i < count; i++) {
+        if (ranks[i] >= count) {
+          throw std::runtime_error("bimap::load - rank out of range");
+        }
+        by_right[i] = by_left[ranks[i]];
+        // strictly increasing rights also make ranks a permutation
+        if (i > 0 && !less<right_tag>(get_node_r(by_right[i - 1])->value,
+                                      get_node_r(by_right[i])->value)) {
+          throw std::runtime_error("bimap::load - rights are not strictly increasing");
+        }
+      }
+
+      if (threads > 1) {
+        // the trees use disjoint links of the nodes
+        parallel_run(2, [&](unsigned i) {
+          if (i == 0) {
+            tree_left = build_balanced<left_tag>(by_left.data(), count, nullptr, (threads + 1) / 2);
+          } else {
+            tree_right = build_balanced<right_tag>(by_right.data(), count, nullptr, threads / 2);
+          }
+        });
       } else {
-        return iterator<left_tag, left_t>(get_opposite<right_tag>(tree), bmp);
+        tree_left = build_balanced<left_tag>(by_left.data(), count, nullptr);
+        tree_right = build_balanced<right_tag>(by_right.data(), count, nullptr);
+      }
+      tree_size = count;
+    } catch (...) {
+      for (splay_tree_t *t : by_left) {
+        destroy_node(t);
       }
+      throw;
     }
+  }
 
-    bool operator==(iterator<Tag, T> const& other) const {
-      return tree == other.tree;
-    }
-    bool operator!=(iterator<Tag, T> const& other) const {
-      return tree != other.tree;
+  /**
+   * fills empty bimap from pairs sorted by left with unique lefts, sorts
+   * the right order on threads threads
+   */
+  void build_sorted_pairs(std::vector<std::pair<left_t, right_t>> const &pairs, unsigned threads) {
+    if (pairs.size() > UINT32_MAX) {
+      throw std::length_error("bimap - too many pairs");
     }
 
-    iterator(node<Tag, T> *tree, bimap const *bmp) : tree(tree), bmp(bmp) {};
-    iterator(iterator const &other) : tree(other.tree), bmp(other.bmp) {};
+    std::vector<std::uint32_t> ranks(pairs.size());
+    for (std::size_t i = 0; i < ranks.size(); i++) {
+      ranks[i] = static_cast<std::uint32_t>(i);
+    }
+    parallel_sort(ranks.begin(), ranks.end(), [&](std::uint32_t a, std::uint32_t b) {
+      return less<right_tag>(pairs[a].second, pairs[b].second);
+    }, threads);
+    for (std::size_t i = 1; i < ranks.size(); i++) {
+      if (!less<right_tag>(pairs[ranks[i - 1]].second, pairs[ranks[i]].second)) {
+        throw std::invalid_argument("bimap - rights are not unique");
+      }
+    }
 
+    build_presorted(
+        pairs.size(), [&](std::size_t i) -> left_t const & { return pairs[i].first; },
+        [&](std::size_t i) -> right_t const & { return pairs[i].second; }, ranks.data(), threads);
+    rebuild_indices();
+  }
 
-    /**
-     * if tree == nullptr, then iterator = end()
-     */
-  private:
-    friend bimap;
-    node<Tag, T> *tree;
-    bimap const *bmp;
-  };
+  enum class set_operation { unite, intersect, subtract };
 
-public:
   /**
-   * interface of bimap
+   * pairs of a op b sorted by left. Lefts of the bigger map cut the key
+   * space into parts of equal size, every part merges its ranges of both
+   * maps on its own thread, the trees are only read
    */
-  using left_iterator = iterator<left_tag, left_t>;
-  using right_iterator = iterator<right_tag, right_t>;
+  static std::vector<std::pair<left_t, right_t>> combine(bimap const &a, bimap const &b,
+                                                         set_operation op, unsigned threads) {
+    using node_l = node<left_tag, left_t>;
+    bimap const &big = a.tree_size >= b.tree_size ? a : b;
+    unsigned parts = parallel_parts(big.tree_size, threads);
+
+    // part i takes lefts from splitters[i], nullptr stands for the ends
+    std::vector<node_l *> splitters(parts + 1, nullptr);
+    for (unsigned i = 1; i < parts; i++) {
+      splitters[i] = walk_nth(big.tree_left, big.tree_size * i / parts);
+    }
 
-  // Создает bimap не содержащий ни одной пары.
+    std::vector<std::vector<std::pair<left_t, right_t>>> results(parts);
+    parallel_run(parts, [&](unsigned i) {
+      auto bound = [&](bimap const &m, node_l *splitter, node_l *none) {
+        return splitter ? m.walk_bound<left_tag>(splitter->value, true) : none;
+      };
+      node_l *ta = bound(a, splitters[i], walk_min(a.tree_left));
+      node_l *ea = bound(a, splitters[i + 1], nullptr);
+      node_l *tb = bound(b, splitters[i], walk_min(b.tree_left));
+      node_l *eb = bound(b, splitters[i + 1], nullptr);
+      auto &out = results[i];
+
+      while (ta != ea || tb != eb) {
+        if (tb == eb || (ta != ea && a.less<left_tag>(ta->value, tb->value))) {
+          if (op != set_operation::intersect) {
+            out.emplace_back(ta->value, get_opposite<left_tag>(ta)->value);
+          }
+          ta = walk_next(ta);
+        } else if (ta == ea || a.less<left_tag>(tb->value, ta->value)) {
+          // a keeps its pairs, a pair of b needs its right to be free in a
+          if (op == set_operation::unite && !a.walk_lookup<right_tag>(get_opposite<left_tag>(tb)->value)) {
+            out.emplace_back(tb->value, get_opposite<left_tag>(tb)->value);
+          }
+          tb = walk_next(tb);
+        } else {
+          bool same = a.equal<right_tag>(get_opposite<left_tag>(ta)->value, get_opposite<left_tag>(tb)->value);
+          if (op == set_operation::unite || (op == set_operation::intersect) == same) {
+            out.emplace_back(ta->value, get_opposite<left_tag>(ta)->value);
+          }
+          ta = walk_next(ta);
+          tb = walk_next(tb);
+        }
+      }
+    });
+
+    if (parts == 1) {
+      return std::move(results[0]);
+    }
+    std::vector<std::pair<left_t, right_t>> res;
+    std::size_t total = 0;
+    for (auto const &part : results) {
+      total += part.size();
+    }
+    res.reserve(total);
+    for (auto &part : results) {
+      std::move(part.begin(), part.end(), std::back_inserter(res));
+      part = {};
+    }
+    return res;
+  }
+
+  static bimap set_operation_result(bimap const &a, bimap const &b, set_operation op, unsigned threads) {
+    std::vector<std::pair<left_t, right_t>> pairs = combine(a, b, op, threads);
+    bimap res(a.compare_left, a.compare_right, a.get_allocator());
+    res.build_sorted_pairs(pairs, threads);
+    return res;
+  }
+
+  template <typename Tag, typename T>
+  node<Tag, T> *zig(node<Tag, T> *t) const{
+    counters.zig(side_of<Tag>);
+    node<Tag, T> *p = t->parent;
+    if (less<Tag>(t->value, t->parent->value)) {
+      t->parent->left = t->right;
+      if (t->right) {
+        t->right->parent = t->parent;
+      }
+
+      t->right = t->parent;
+    } else {
+      t->parent->right = t->left;
+      if (t->left) {
+        t->left->parent = t->parent;
+      }
+
+      t->left = t->parent;
+    }
+
+    node<Tag, T> *tmp = t->parent->parent;
+    t->parent->parent = t;
+    t->parent = tmp;
+
+    p->update_size();
+    t->update_size();
+    return t;
+  }
+
+  template <typename Tag, typename T>
+  node<Tag, T> *splay(node<Tag, T> *t) const {
+    while (t && t->parent) {
+      if (!t->parent->parent) {
+        t = zig(t);
+        break;
+      }
+
+      bool t_to_p = less<Tag>(t->value, t->parent->value);
+      bool p_to_pp = less<Tag>(t->parent->value, t->parent->parent->value);
+      if (t_to_p == p_to_pp) {
+        t->parent = zig(t->parent);
+        t = zig(t);
+      } else {
+        t = zig(t);
+        t = zig(t);
+      }
+    }
+
+    return get_root<Tag, T>() = t;
+  }
+
+  template <typename Tag, typename T>
+  node<Tag, T> *find_max(node<Tag, T> *t) const {
+    while (t->right) {
+      t = t->right;
+    }
+
+    return set_tree_root(t);
+  }
+
+  template <typename Tag, typename T>
+  void merge(node<Tag, T> *a, node<Tag, T> *b) const {
+    if (!a) {
+      set_tree_root(b);
+      return;
+    }
+    if (!b) {
+      set_tree_root(a);
+      return;
+    }
+
+    a = find_max(a);
+    a->right = b;
+    b->parent = a;
+    a->update_size();
+  }
+
+  /**
+   * Non-rotating counterparts of find, bounds, next and prev: they only read
+   * the links, so any number of threads may call them while nobody modifies
+   * the bimap
+   */
+
+  /**
+   * @return node with equal value or nullptr
+   */
+  template <typename Tag, typename K>
+  node_t<Tag> *walk_find(K const &value) const {
+    node_t<Tag> *t = get_root<Tag, value_t<Tag>>();
+
+    while (t) {
+      if (less<Tag>(t->value, value)) {
+        t = t->right;
+      } else if (less<Tag>(value, t->value)) {
+        t = t->left;
+      } else {
+        return t;
+      }
+    }
+    return nullptr;
+  }
+
+  /**
+   * @return first node with node->value >= value if lower_bound,
+   * with node->value > value otherwise, nullptr if there is no such node
+   */
+  template <typename Tag, typename K>
+  node_t<Tag> *walk_bound(K const &value, bool lower_bound) const {
+    node_t<Tag> *t = get_root<Tag, value_t<Tag>>();
+    node_t<Tag> *res = nullptr;
+
+    while (t) {
+      if (lower_bound ? !less<Tag>(t->value, value)
+                      : less<Tag>(value, t->value)) {
+        res = t;
+        t = t->left;
+      } else {
+        t = t->right;
+      }
+    }
+    return res;
+  }
+
+  template <typename Tag, typename T>
+  static node<Tag, T> *walk_min(node<Tag, T> *t) {
+    if (!t) {
+      return t;
+    }
+
+    while (t->left) {
+      t = t->left;
+    }
+    return t;
+  }
+
+  /**
+   * descends by subtree sizes
+   * @return k-th (from 0) node of the tree with root t, nullptr if k >= size
+   */
+  template <typename Tag, typename T>
+  static node<Tag, T> *walk_nth(node<Tag, T> *t, std::size_t k) {
+    while (t) {
+      std::size_t smaller = node<Tag, T>::size_of(t->left);
+      if (k < smaller) {
+        t = t->left;
+      } else if (k > smaller) {
+        k -= smaller + 1;
+        t = t->right;
+      } else {
+        return t;
+      }
+    }
+    return nullptr;
+  }
+
+  template <typename Tag, typename T>
+  static node<Tag, T> *walk_max(node<Tag, T> *t) {
+    if (!t) {
+      return t;
+    }
+
+    while (t->right) {
+      t = t->right;
+    }
+    return t;
+  }
+
+  /**
+   * @return next element by parent links or nullptr if t is the last one
+   */
+  template <typename Tag, typename T>
+  static node<Tag, T> *walk_next(node<Tag, T> *t) {
+    if (t->right) {
+      return walk_min(t->right);
+    }
+
+    while (t->parent && t->parent->right == t) {
+      t = t->parent;
+    }
+    return t->parent;
+  }
+
+  template <typename Tag, typename T>
+  static node<Tag, T> *walk_prev(node<Tag, T> *t) {
+    if (t->left) {
+      return walk_max(t->left);
+    }
+
+    while (t->parent && t->parent->left == t) {
+      t = t->parent;
+    }
+    return t->parent;
+  }
+
+  /**
+   * finger search: climbs from finger to the lowest subtree around it which
+   * holds the place of value, then descends. Only ancestors on the side of
+   * value bound such subtrees, so just they are compared and lookups close
+   * to finger don't pass the root. Never restructures the tree
+   * @param finger any node of the tree or nullptr to start from the root,
+   * becomes the last visited node
+   * @return node with equal value or nullptr
+   */
+  template <typename Tag, typename K>
+  node_t<Tag> *walk_finger(node_t<Tag> *&finger, K const &value) const {
+    node_t<Tag> *t = finger ? finger : get_root<Tag, value_t<Tag>>();
+
+    if (finger) {
+      bool to_right = less<Tag>(t->value, value);
+      if (to_right || less<Tag>(value, t->value)) {
+        for (node_t<Tag> *c = t; c->parent; c = c->parent) {
+          node_t<Tag> *p = c->parent;
+          if ((p->left == c) != to_right) {
+            continue;
+          }
+          if (to_right ? less<Tag>(value, p->value) : less<Tag>(p->value, value)) {
+            break;
+          }
+          t = p;
+          if (to_right ? !less<Tag>(p->value, value) : !less<Tag>(value, p->value)) {
+            break;
+          }
+        }
+      }
+    }
+
+    while (t) {
+      finger = t;
+      if (less<Tag>(t->value, value)) {
+        t = t->right;
+      } else if (less<Tag>(value, t->value)) {
+        t = t->left;
+      } else {
+        return t;
+      }
+    }
+    return nullptr;
+  }
+
+  /**
+   * looks up every key of [first, last): keys are sorted once and found by
+   * finger search from the previous answer, hash indices answer directly
+   * @return found nodes (or nullptr) in order of the keys
+   */
+  template <typename Tag, typename ForwardIt>
+  std::vector<node_t<Tag> *> batch_lookup(ForwardIt first, ForwardIt last) const {
+    using key_t = std::remove_cv_t<std::remove_reference_t<decltype(*first)>>;
+
+    std::vector<key_t const *> keys;
+    for (; first != last; ++first) {
+      keys.push_back(std::addressof(*first));
+    }
+    std::vector<node_t<Tag> *> res(keys.size());
+
+    if constexpr (hashed<Tag> && (std::is_same_v<key_t, value_t<Tag>> ||
+                                  is_transparent<hash_t<Tag>>::value)) {
+      for (std::size_t i = 0; i < keys.size(); i++) {
+        res[i] = lookup<Tag>(*keys[i]);
+      }
+      return res;
+    }
+
+    std::vector<std::size_t> order(keys.size());
+    for (std::size_t i = 0; i < order.size(); i++) {
+      order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+      return less<Tag>(*keys[a], *keys[b]);
+    });
+
+    node_t<Tag> *finger = nullptr;
+    for (std::size_t i : order) {
+      res[i] = walk_finger<Tag>(finger, *keys[i]);
+    }
+    return res;
+  }
+
+  template <typename Tag, typename T>
+  struct iterator {
+    // Элемент на который сейчас ссылается итератор.
+    // Разыменование итератора end_left() неопределено.
+    // Разыменование невалидного итератора неопределено.
+    T const &operator*() const {
+      return tree->value;
+    }
+
+    // Переход к следующему по величине left'у.
+    // Инкремент итератора end_left() неопределен.
+    // Инкремент невалидного итератора неопределен.
+    iterator &operator++() {
+      tree = bmp->next<Tag, T>(tree);
+      return *this;
+    }
+    iterator operator++(int) {
+      node<Tag, T> *old = tree;
+      ++*this;
+
+      return {old, bmp};
+    }
+
+    // Переход к предыдущему по величине left'у.
+    // Декремент итератора begin_left() неопределен.
+    // Декремент невалидного итератора неопределен.
+    iterator &operator--() {
+      tree = bmp->prev<Tag, T>(tree);
+      return *this;
+    }
+    iterator operator--(int) {
+      node<Tag, T> *old = tree;
+      --*this;
+
+      return {old, bmp};
+    }
+
+    // left_iterator ссылается на левый элемент некоторой пары.
+    // Эта функция возвращает итератор на правый элемент той же пары.
+    // end_left().flip() возращает end_right().
+    // end_right().flip() возвращает end_left().
+    // flip() невалидного итератора неопределен.
+
+    auto flip() const {
+      if constexpr (std::is_same_v<Tag, left_tag>) {
+        return iterator<right_tag, right_t>(get_opposite<left_tag>(tree), bmp);
+      } else {
+        return iterator<left_tag, left_t>(get_opposite<right_tag>(tree), bmp);
+      }
+    }
+
+    bool operator==(iterator<Tag, T> const& other) const {
+      return tree == other.tree;
+    }
+    bool operator!=(iterator<Tag, T> const& other) const {
+      return tree != other.tree;
+    }
+
+    iterator(node<Tag, T> *tree, bimap const *bmp) : tree(tree), bmp(bmp) {};
+    iterator(iterator const &other) : tree(other.tree), bmp(other.bmp) {};
+
+
+    /**
+     * if tree == nullptr, then iterator = end()
+     */
+  private:
+    friend bimap;
+    node<Tag, T> *tree;
+    bimap const *bmp;
+  };
+
+  /**
+   * iterator of const_view: moves by parent links and never splays
+   */
+  template <typename Tag, typename T>
+  struct view_iterator {
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = T const *;
+    using reference = T const &;
+
+    T const &operator*() const {
+      return tree->value;
+    }
+
+    view_iterator &operator++() {
+      tree = walk_next(tree);
+      return *this;
+    }
+    view_iterator operator++(int) {
+      node<Tag, T> *old = tree;
+      ++*this;
+
+      return {old, bmp};
+    }
+
+    // Декремент end() переходит к максимальному элементу.
+    view_iterator &operator--() {
+      tree = tree ? walk_prev(tree) : walk_max(bmp->get_root<Tag, T>());
+      return *this;
+    }
+    view_iterator operator--(int) {
+      node<Tag, T> *old = tree;
+      --*this;
+
+      return {old, bmp};
+    }
+
+    auto flip() const {
+      if constexpr (std::is_same_v<Tag, left_tag>) {
+        return view_iterator<right_tag, right_t>(get_opposite<left_tag>(tree), bmp);
+      } else {
+        return view_iterator<left_tag, left_t>(get_opposite<right_tag>(tree), bmp);
+      }
+    }
+
+    bool operator==(view_iterator<Tag, T> const &other) const {
+      return tree == other.tree;
+    }
+    bool operator!=(view_iterator<Tag, T> const &other) const {
+      return tree != other.tree;
+    }
+
+    view_iterator(node<Tag, T> *tree, bimap const *bmp) : tree(tree), bmp(bmp) {}
+
+  private:
+    friend bimap;
+    node<Tag, T> *tree;
+    bimap const *bmp;
+  };
+
+public:
+  /**
+   * interface of bimap
+   */
+  using left_iterator = iterator<left_tag, left_t>;
+  using right_iterator = iterator<right_tag, right_t>;
+
+  // Представление bimap только для чтения. Поиск, bound'ы и обход через него
+  // не перестраивают деревья, поэтому пока bimap никто не изменяет, им может
+  // одновременно пользоваться любое количество потоков.
+  // Любое изменение bimap инвалидирует итераторы представления.
+  struct const_view {
+    using left_iterator = view_iterator<left_tag, left_t>;
+    using right_iterator = view_iterator<right_tag, right_t>;
+
+    explicit const_view(bimap const &bmp) : bmp(&bmp) {}
+
+    left_iterator find_left(left_t const &left) const {
+      return left_iterator(bmp->walk_lookup<left_tag>(left), bmp);
+    }
+    right_iterator find_right(right_t const &right) const {
+      return right_iterator(bmp->walk_lookup<right_tag>(right), bmp);
+    }
+
+    right_t const &at_left(left_t const &key) const {
+      node<left_tag, left_t> *t = bmp->walk_lookup<left_tag>(key);
+      if (!t) {
+        throw std::out_of_range("bimap::const_view::at_left - no such element");
+      }
+      return get_opposite<left_tag>(t)->value;
+    }
+    left_t const &at_right(right_t const &key) const {
+      node<right_tag, right_t> *t = bmp->walk_lookup<right_tag>(key);
+      if (!t) {
+        throw std::out_of_range("bimap::const_view::at_right - no such element");
+      }
+      return get_opposite<right_tag>(t)->value;
+    }
+
+    left_iterator lower_bound_left(left_t const &left) const {
+      return left_iterator(bmp->walk_bound<left_tag>(left, true), bmp);
+    }
+    left_iterator upper_bound_left(left_t const &left) const {
+      return left_iterator(bmp->walk_bound<left_tag>(left, false), bmp);
+    }
+
+    right_iterator lower_bound_right(right_t const &right) const {
+      return right_iterator(bmp->walk_bound<right_tag>(right, true), bmp);
+    }
+    right_iterator upper_bound_right(right_t const &right) const {
+      return right_iterator(bmp->walk_bound<right_tag>(right, false), bmp);
+    }
+
+    // Поиск и bound'ы по значению другого типа при прозрачном компараторе,
+    // как у bimap.
+    template <typename K, typename C = CompareLeft, typename = typename C::is_transparent>
+    left_iterator find_left(K const &left) const {
+      return left_iterator(bmp->walk_lookup<left_tag>(left), bmp);
+    }
+    template <typename K, typename C = CompareRight, typename = typename C::is_transparent>
+    right_iterator find_right(K const &right) const {
+      return right_iterator(bmp->walk_lookup<right_tag>(right), bmp);
+    }
+
+    template <typename K, typename C = CompareLeft, typename = typename C::is_transparent>
+    right_t const &at_left(K const &key) const {
+      node<left_tag, left_t> *t = bmp->walk_lookup<left_tag>(key);
+      if (!t) {
+        throw std::out_of_range("bimap::const_view::at_left - no such element");
+      }
+      return get_opposite<left_tag>(t)->value;
+    }
+    template <typename K, typename C = CompareRight, typename = typename C::is_transparent>
+    left_t const &at_right(K const &key) const {
+      node<right_tag, right_t> *t = bmp->walk_lookup<right_tag>(key);
+      if (!t) {
+        throw std::out_of_range("bimap::const_view::at_right - no such element");
+      }
+      return get_opposite<right_tag>(t)->value;
+    }
+
+    template <typename K, typename C = CompareLeft, typename = typename C::is_transparent>
+    left_iterator lower_bound_left(K const &left) const {
+      return left_iterator(bmp->walk_bound<left_tag>(left, true), bmp);
+    }
+    template <typename K, typename C = CompareLeft, typename = typename C::is_transparent>
+    left_iterator upper_bound_left(K const &left) const {
+      return left_iterator(bmp->walk_bound<left_tag>(left, false), bmp);
+    }
+
+    template <typename K, typename C = CompareRight, typename = typename C::is_transparent>
+    right_iterator lower_bound_right(K const &right) const {
+      return right_iterator(bmp->walk_bound<right_tag>(right, true), bmp);
+    }
+    template <typename K, typename C = CompareRight, typename = typename C::is_transparent>
+    right_iterator upper_bound_right(K const &right) const {
+      return right_iterator(bmp->walk_bound<right_tag>(right, false), bmp);
+    }
+
+    left_iterator begin_left() const {
+      return left_iterator(walk_min(bmp->tree_left), bmp);
+    }
+    left_iterator end_left() const {
+      return left_iterator(nullptr, bmp);
+    }
+
+    right_iterator begin_right() const {
+      return right_iterator(walk_min(bmp->tree_right), bmp);
+    }
+    right_iterator end_right() const {
+      return right_iterator(nullptr, bmp);
+    }
+
+    bool empty() const {
+      return bmp->empty();
+    }
+    std::size_t size() const {
+      return bmp->size();
+    }
+
+  private:
+    bimap const *bmp;
+  };
+
+  // Возвращает представление только для чтения над этим bimap.
+  const_view view() const {
+    return const_view(*this);
+  }
+
+  // Диапазон [begin, end) итераторов const_view для range-for и алгоритмов.
+  template <typename Iterator>
+  struct scan_range {
+    Iterator begin() const {
+      return first;
+    }
+    Iterator end() const {
+      return last;
+    }
+
+    Iterator first;
+    Iterator last;
+  };
+
+  // Обход всех элементов стороны по возрастанию без перестройки деревьев:
+  // шаг идет по родительским ссылкам и стоит амортизированно O(1), тогда
+  // как шаг left_iterator'а делает два splay.
+  // Любое изменение bimap инвалидирует диапазон.
+  scan_range<typename const_view::left_iterator> scan_left() const {
+    return {view().begin_left(), view().end_left()};
+  }
+  scan_range<typename const_view::right_iterator> scan_right() const {
+    return {view().begin_right(), view().end_right()};
+  }
+
+  // Создает bimap не содержащий ни одной пары.
+  // Все пары размещаются через allocator (см. pool_allocator.h).
   bimap(CompareLeft compare_left = CompareLeft(),
-        CompareRight compare_right = CompareRight())
+        CompareRight compare_right = CompareRight(),
+        Allocator const &allocator = Allocator())
       : tree_left(nullptr), tree_right(nullptr),
-        compare_left(compare_left), compare_right(compare_right), tree_size(0) {}
+        compare_left(compare_left), compare_right(compare_right),
+        allocator(allocator), index_left(this->allocator), index_right(this->allocator),
+        tree_size(0) {}
 
   // Конструкторы от других и присваивания
+  // Копирование работает за O(n) и не перестраивает деревья other.
   bimap(bimap const &other) : tree_left(nullptr), tree_right(nullptr),
-    compare_left(other.compare_left), compare_right(other.compare_right), tree_size(other.tree_size) {
-    for (left_iterator it = other.begin_left(); it != other.end_left(); it++) {
-      auto *tmp = new splay_tree_t(*it, other.at_left(*it));
-      insert_both_trees(tmp);
+    compare_left(other.compare_left), compare_right(other.compare_right),
+    allocator(node_traits::select_on_container_copy_construction(other.allocator)),
+    index_left(allocator), index_right(allocator), tree_size(other.tree_size) {
+    try {
+      clone_trees(other);
+      rebuild_indices();
+    } catch (...) {
+      destroy(tree_left);
+      throw;
     }
   }
   bimap(bimap &&other) noexcept
       : tree_left(other.tree_left), tree_right(other.tree_right),
         compare_left(std::move(other.compare_left)),
         compare_right(std::move(other.compare_right)),
-        tree_size(other.tree_size) {}
+        allocator(std::move(other.allocator)),
+        index_left(std::move(other.index_left)), index_right(std::move(other.index_right)),
+        tree_size(other.tree_size) {
+    other.tree_left = nullptr;
+    other.tree_right = nullptr;
+    other.tree_size = 0;
+  }
 
   bimap &operator=(bimap const &other) {
     if (this == &other) {
@@ -437,24 +1385,516 @@ public:
     destroy(tree_left);
   }
 
+  // Строит bimap из пар (left, right), отсортированных по left, за O(n)
+  // по левой стороне и одну сортировку по правой, без поиска в деревьях.
+  // Если left'ы не строго возрастают или right'ы повторяются, бросает
+  // std::invalid_argument.
+  template <typename InputIt>
+  static bimap from_sorted(InputIt first, InputIt last,
+                           CompareLeft compare_left = CompareLeft(),
+                           CompareRight compare_right = CompareRight(),
+                           Allocator const &allocator = Allocator()) {
+    bimap res(compare_left, compare_right, allocator);
+    res.build_sorted(first, last);
+    res.rebuild_indices();
+    return res;
+  }
+  template <typename Range>
+  static bimap from_sorted(Range const &range,
+                           CompareLeft compare_left = CompareLeft(),
+                           CompareRight compare_right = CompareRight(),
+                           Allocator const &allocator = Allocator()) {
+    return from_sorted(std::begin(range), std::end(range), compare_left,
+                       compare_right, allocator);
+  }
+
+  // Записывает все пары в os в бинарном формате без указателей
+  // (см. bimap_format.h), деревья при этом не перестраиваются.
+  // Только для тривиально копируемых left_t и right_t.
+  // При ошибке записи бросает std::runtime_error.
+  void save(std::ostream &os) const {
+    static_assert(std::is_trivially_copyable_v<left_t> && std::is_trivially_copyable_v<right_t>,
+                  "bimap::save - left_t and right_t have to be trivially copyable");
+    if (tree_size > UINT32_MAX) {
+      throw std::length_error("bimap::save - too many pairs");
+    }
+
+    std::vector<left_t> lefts;
+    std::vector<right_t> rights;
+    lefts.reserve(tree_size);
+    rights.reserve(tree_size);
+    for (node<left_tag, left_t> *t = walk_min(tree_left); t; t = walk_next(t)) {
+      lefts.push_back(t->value);
+      rights.push_back(get_opposite<left_tag>(t)->value);
+    }
+
+    // positions of the pairs in order of right
+    std::vector<std::uint32_t> ranks(tree_size);
+    for (std::size_t i = 0; i < ranks.size(); i++) {
+      ranks[i] = static_cast<std::uint32_t>(i);
+    }
+    std::sort(ranks.begin(), ranks.end(), [&](std::uint32_t a, std::uint32_t b) {
+      return less<right_tag>(rights[a], rights[b]);
+    });
+
+    bimap_file_layout layout(tree_size, sizeof(left_t), sizeof(right_t));
+    std::size_t position = 0;
+    auto write = [&](void const *data, std::size_t size, std::size_t offset) {
+      static char const zeros[bimap_file_layout::alignment] = {};
+      os.write(zeros, static_cast<std::streamsize>(offset - position));
+      os.write(static_cast<char const *>(data), static_cast<std::streamsize>(size));
+      position = offset + size;
+    };
+
+    bimap_file_header header = bimap_file_layout::header(tree_size, sizeof(left_t), sizeof(right_t));
+    write(&header, sizeof(header), 0);
+    write(lefts.data(), lefts.size() * sizeof(left_t), layout.lefts);
+    write(rights.data(), rights.size() * sizeof(right_t), layout.rights);
+
+    lefts.clear();
+    lefts.shrink_to_fit();
+    std::vector<right_t> sorted_rights;
+    sorted_rights.reserve(tree_size);
+    for (std::uint32_t rank : ranks) {
+      sorted_rights.push_back(rights[rank]);
+    }
+    write(sorted_rights.data(), sorted_rights.size() * sizeof(right_t), layout.sorted_rights);
+    write(ranks.data(), ranks.size() * sizeof(std::uint32_t), layout.ranks);
+
+    if (!os) {
+      throw std::runtime_error("bimap::save - write failed");
+    }
+  }
+
+  void save_to_file(std::string const &path) const {
+    std::ofstream os(path, std::ios::binary | std::ios::trunc);
+    if (!os) {
+      throw std::runtime_error("bimap::save_to_file - cannot open " + path);
+    }
+    save(os);
+    os.close();
+    if (!os) {
+      throw std::runtime_error("bimap::save_to_file - write failed");
+    }
+  }
+
+  // Читает bimap, записанный save, и строит оба дерева за O(n) без
+  // сортировки и поиска. Если данные повреждены или записаны для других
+  // типов, бросает std::runtime_error.
+  static bimap load(std::istream &is,
+                    CompareLeft compare_left = CompareLeft(),
+                    CompareRight compare_right = CompareRight(),
+                    Allocator const &allocator = Allocator()) {
+    static_assert(std::is_trivially_copyable_v<left_t> && std::is_trivially_copyable_v<right_t>,
+                  "bimap::load - left_t and right_t have to be trivially copyable");
+    static_assert(alignof(left_t) <= bimap_file_layout::alignment &&
+                  alignof(right_t) <= bimap_file_layout::alignment,
+                  "bimap::load - left_t and right_t are over-aligned");
+
+    bimap_file_header header;
+    if (!is.read(reinterpret_cast<char *>(&header), sizeof(header))) {
+      throw std::runtime_error("bimap::load - unexpected end of data");
+    }
+    bimap_file_layout::check(header, sizeof(left_t), sizeof(right_t), "bimap::load");
+    bimap_file_layout layout(header.count, sizeof(left_t), sizeof(right_t));
+
+    // sections are read as they lie in the file, offsets stay aligned.
+    // The buffer grows by bounded chunks with the data actually read, so a
+    // corrupted count fails as end of data instead of a huge allocation.
+    static constexpr std::size_t chunk = std::size_t(1) << 20;
+    std::size_t total = layout.size - sizeof(header);
+    std::vector<unsigned char> data;
+    while (data.size() < total) {
+      std::size_t read = data.size();
+      data.resize(read + std::min(chunk, total - read));
+      if (!is.read(reinterpret_cast<char *>(data.data() + read), static_cast<std::streamsize>(data.size() - read))) {
+        throw std::runtime_error("bimap::load - unexpected end of data");
+      }
+    }
+    auto section = [&](std::size_t offset) { return data.data() + offset - sizeof(header); };
+
+    bimap res(compare_left, compare_right, allocator);
+    auto lefts = reinterpret_cast<left_t const *>(section(layout.lefts));
+    auto rights = reinterpret_cast<right_t const *>(section(layout.rights));
+    res.build_presorted(
+        header.count, [lefts](std::size_t i) -> left_t const & { return lefts[i]; },
+        [rights](std::size_t i) -> right_t const & { return rights[i]; },
+        reinterpret_cast<std::uint32_t const *>(section(layout.ranks)));
+    res.rebuild_indices();
+    return res;
+  }
+
+  static bimap load_from_file(std::string const &path,
+                              CompareLeft compare_left = CompareLeft(),
+                              CompareRight compare_right = CompareRight(),
+                              Allocator const &allocator = Allocator()) {
+    std::ifstream is(path, std::ios::binary);
+    if (!is) {
+      throw std::runtime_error("bimap::load_from_file - cannot open " + path);
+    }
+    return load(is, compare_left, compare_right, allocator);
+  }
+
+  // Параллельные массовые операции на std::thread (см. parallel.h).
+  // Компараторы и хэши вызываются из нескольких потоков одновременно.
+
+  // Строит bimap из пар в произвольном порядке: обе сортировки и
+  // связывание деревьев идут в threads потоках.
+  // Если left'ы или right'ы повторяются, бросает std::invalid_argument.
+  static bimap from_pairs(std::vector<std::pair<left_t, right_t>> pairs,
+                          unsigned threads = parallel_threads(),
+                          CompareLeft compare_left = CompareLeft(),
+                          CompareRight compare_right = CompareRight(),
+                          Allocator const &allocator = Allocator()) {
+    bimap res(compare_left, compare_right, allocator);
+    parallel_sort(pairs.begin(), pairs.end(), [&res](auto const &a, auto const &b) {
+      return res.less<left_tag>(a.first, b.first);
+    }, threads);
+    for (std::size_t i = 1; i < pairs.size(); i++) {
+      if (!res.less<left_tag>(pairs[i - 1].first, pairs[i].first)) {
+        throw std::invalid_argument("bimap::from_pairs - lefts are not unique");
+      }
+    }
+    res.build_sorted_pairs(pairs, threads);
+    return res;
+  }
+
+  // Вызывает f(left, right) для каждой пары. Пары делятся по порядку left
+  // на непересекающиеся отрезки (по размерам поддеревьев), каждый обходит
+  // свой поток, деревья не перестраиваются. Порядок вызовов не определен.
+  template <typename F>
+  void for_each_pair(F const &f, unsigned threads = parallel_threads()) const {
+    unsigned parts = parallel_parts(tree_size, threads);
+    parallel_run(parts, [&](unsigned i) {
+      std::size_t first = tree_size * i / parts, last = tree_size * (i + 1) / parts;
+      node<left_tag, left_t> *t = walk_nth(tree_left, first);
+      for (std::size_t k = first; k < last; k++, t = walk_next(t)) {
+        f(t->value, get_opposite<left_tag>(t)->value);
+      }
+    });
+  }
+
+  // Операции над множествами пар, результат -- новый bimap с
+  // компараторами и аллокатором a.
+  // set_union -- пары a и те пары b, у которых left и right свободны в a;
+  // set_intersection -- пары, которые есть в обоих;
+  // set_difference -- пары a, которых нет в b.
+  static bimap set_union(bimap const &a, bimap const &b, unsigned threads = parallel_threads()) {
+    return set_operation_result(a, b, set_operation::unite, threads);
+  }
+  static bimap set_intersection(bimap const &a, bimap const &b, unsigned threads = parallel_threads()) {
+    return set_operation_result(a, b, set_operation::intersect, threads);
+  }
+  static bimap set_difference(bimap const &a, bimap const &b, unsigned threads = parallel_threads()) {
+    return set_operation_result(a, b, set_operation::subtract, threads);
+  }
+
+  allocator_type get_allocator() const {
+    return allocator_type(allocator);
+  }
+
+  // Компараторы сторон, с которыми упорядочены пары
+  CompareLeft key_comp_left() const {
+    return compare_left;
+  }
+  CompareRight key_comp_right() const {
+    return compare_right;
+  }
+
   // Вставка пары (left, right), возвращает итератор на left.
   // Если такой left или такой right уже присутствуют в bimap, вставка не
   // производится и возвращается end_left().
   left_iterator insert(left_t const &left, right_t const &right) {
-    return !contains(left, right) ? insert_operation<left_tag, left_t>(
-               new splay_tree_t(left, right)) : end_left();
+    return insert_result(insert_unique(left, right));
   }
   left_iterator insert(left_t const &left, right_t &&right) {
-    return !contains(left, right) ? insert_operation<left_tag, left_t>(
-               new splay_tree_t(left, std::move(right))) : end_left();
+    return insert_result(insert_unique(left, std::move(right)));
   }
   left_iterator insert(left_t &&left, right_t const &right) {
-    return !contains(left, right) ? insert_operation<left_tag, left_t>(
-               new splay_tree_t(std::move(left), right)) : end_left();
+    return insert_result(insert_unique(std::move(left), right));
   }
   left_iterator insert(left_t &&left, right_t &&right) {
-    return !contains(left, right) ? insert_operation<left_tag, left_t>(
-               new splay_tree_t(std::move(left), std::move(right))) : end_left();
+    return insert_result(insert_unique(std::move(left), std::move(right)));
+  }
+
+  // Вставка с подсказкой: поиск места начинается от пары, на которую
+  // указывает hint (left_iterator или right_iterator, end -- от максимума),
+  // и стоит амортизированно O(log d), где d -- расстояние от hint.
+  // Результат как у insert без подсказки.
+  template <typename Tag, typename T>
+  left_iterator insert(iterator<Tag, T> hint, left_t const &left, right_t const &right) {
+    return insert_result(insert_hinted(hint, left, right));
+  }
+  template <typename Tag, typename T>
+  left_iterator insert(iterator<Tag, T> hint, left_t const &left, right_t &&right) {
+    return insert_result(insert_hinted(hint, left, std::move(right)));
+  }
+  template <typename Tag, typename T>
+  left_iterator insert(iterator<Tag, T> hint, left_t &&left, right_t const &right) {
+    return insert_result(insert_hinted(hint, std::move(left), right));
+  }
+  template <typename Tag, typename T>
+  left_iterator insert(iterator<Tag, T> hint, left_t &&left, right_t &&right) {
+    return insert_result(insert_hinted(hint, std::move(left), std::move(right)));
+  }
+
+  // Вставка пары (left, right) за один спуск по каждому дереву.
+  // Возвращает итератор на вставленный left и true, либо, если left или
+  // right уже присутствуют, итератор на left мешающей пары и false.
+  std::pair<left_iterator, bool> try_insert(left_t const &left, right_t const &right) {
+    return insert_unique(left, right);
+  }
+  std::pair<left_iterator, bool> try_insert(left_t const &left, right_t &&right) {
+    return insert_unique(left, std::move(right));
+  }
+  std::pair<left_iterator, bool> try_insert(left_t &&left, right_t const &right) {
+    return insert_unique(std::move(left), right);
+  }
+  std::pair<left_iterator, bool> try_insert(left_t &&left, right_t &&right) {
+    return insert_unique(std::move(left), std::move(right));
+  }
+
+  // Строит пару прямо в узле: left_t из left_args, right_t из right_args,
+  // значения не копируются и не перемещаются. Результат как у try_insert,
+  // но узел создается до проверки на дубликаты.
+  template <typename... LeftArgs, typename... RightArgs>
+  std::pair<left_iterator, bool> emplace(std::piecewise_construct_t,
+                                         std::tuple<LeftArgs...> left_args,
+                                         std::tuple<RightArgs...> right_args) {
+    splay_tree_t *new_node = create_node(std::piecewise_construct, std::move(left_args),
+                                         std::move(right_args));
+    try {
+      auto res = insert_checked(get_node_l(new_node)->value, get_node_r(new_node)->value,
+                                [new_node] { return new_node; });
+      if (!res.second) {
+        destroy_node(new_node);
+      }
+      return res;
+    } catch (...) {
+      destroy_node(new_node);
+      throw;
+    }
+  }
+
+  // Вставка пары, left_t строится из left, right_t из right прямо в узле.
+  // Если left и right сравнимы с ключами без преобразования (того же типа
+  // или компаратор прозрачный), дубликаты ищутся до выделения памяти
+  // и создания значений.
+  template <typename L, typename R,
+            std::enable_if_t<std::is_constructible_v<left_t, L &&> &&
+                             std::is_constructible_v<right_t, R &&>, int> = 0>
+  std::pair<left_iterator, bool> try_emplace(L &&left, R &&right) {
+    if constexpr (comparable_key<left_tag, L> && comparable_key<right_tag, R>) {
+      return insert_checked(left, right, [&] {
+        return create_node(std::piecewise_construct, std::forward_as_tuple(std::forward<L>(left)),
+                           std::forward_as_tuple(std::forward<R>(right)));
+      });
+    } else {
+      return emplace(std::piecewise_construct, std::forward_as_tuple(std::forward<L>(left)),
+                     std::forward_as_tuple(std::forward<R>(right)));
+    }
+  }
+
+  // Владеющий дескриптор пары, извлеченной из bimap (см. extract_left).
+  // Пара остается в своем узле, поэтому вставка в bimap с равным аллокатором
+  // не выделяет память и не копирует значения.
+  struct node_type {
+    node_type() = default;
+
+    node_type(node_type &&other) noexcept
+        : pair(other.pair), allocator(std::move(other.allocator)) {
+      other.release();
+    }
+    node_type &operator=(node_type &&other) noexcept {
+      if (this != &other) {
+        reset();
+        pair = other.pair;
+        allocator = std::move(other.allocator);
+        other.release();
+      }
+      return *this;
+    }
+
+    ~node_type() {
+      reset();
+    }
+
+    bool empty() const {
+      return !pair;
+    }
+    explicit operator bool() const {
+      return pair;
+    }
+
+    // Значения можно менять, пока пара не вставлена обратно.
+    left_t &left() const {
+      return get_node_l(pair)->value;
+    }
+    right_t &right() const {
+      return get_node_r(pair)->value;
+    }
+
+    allocator_type get_allocator() const {
+      return allocator_type(*allocator);
+    }
+
+  private:
+    friend bimap;
+
+    node_type(splay_tree_t *pair, node_allocator_t const &allocator)
+        : pair(pair), allocator(allocator) {}
+
+    void release() noexcept {
+      pair = nullptr;
+      allocator.reset();
+    }
+
+    void reset() noexcept {
+      if (pair) {
+        node_traits::destroy(*allocator, pair);
+        node_traits::deallocate(*allocator, pair, 1);
+      }
+      release();
+    }
+
+    splay_tree_t *pair = nullptr;
+    std::optional<node_allocator_t> allocator;
+  };
+
+  // Результат вставки node_type: если пара не вставлена, node владеет ей.
+  struct insert_return_type {
+    left_iterator position;
+    bool inserted;
+    node_type node;
+  };
+
+  // Извлекает пару из bimap без освобождения памяти.
+  // Инвалидирует итераторы на элементы пары.
+  node_type extract_left(left_iterator it) {
+    splay_tree_t *pair = get_splay_l(it.tree);
+    detach_pair(pair);
+    return node_type(pair, allocator);
+  }
+  node_type extract_right(right_iterator it) {
+    return extract_left(it.flip());
+  }
+  // Извлекает пару по ключу, если ее нет -- возвращает пустой node_type.
+  node_type extract_left(left_t const &left) {
+    node<left_tag, left_t> *t = lookup<left_tag>(left);
+    return t ? extract_left(left_iterator(t, this)) : node_type();
+  }
+  node_type extract_right(right_t const &right) {
+    node<right_tag, right_t> *t = lookup<right_tag>(right);
+    return t ? extract_right(right_iterator(t, this)) : node_type();
+  }
+
+  // Вставляет извлеченную пару, переиспользуя ее узел. Если left или right
+  // уже присутствуют, пара остается в node, а position указывает на left
+  // мешающей пары. Если аллокатор nh не равен аллокатору bimap, значения
+  // перемещаются в новый узел, а старый освобождается аллокатором nh.
+  insert_return_type insert(node_type &&nh) {
+    if (nh.empty()) {
+      return {end_left(), false, node_type()};
+    }
+
+    splay_tree_t *pair = nh.pair;
+    bool relink = *nh.allocator == allocator;
+    auto res = insert_checked(get_node_l(pair)->value, get_node_r(pair)->value, [this, pair, relink] {
+      if (!relink) {
+        return create_moved(pair);
+      }
+      reset_links(pair);
+      return pair;
+    });
+    if (!res.second) {
+      return {res.first, false, std::move(nh)};
+    }
+
+    if (relink) {
+      nh.release();
+    } else {
+      nh.reset();
+    }
+    return {res.first, true, node_type()};
+  }
+
+  // Переносит из source все пары, чьих left и right еще нет в этом bimap,
+  // переиспользуя их узлы. Остальные пары остаются в source.
+  // Стоит O(m log n) для m пар source, а если source сравним по размеру
+  // с этим bimap -- O(n + m): деревья обоих строятся заново за несколько
+  // совместных обходов. Если аллокаторы не равны, узлы не переносятся:
+  // значения перемещаются в новые узлы за O(m log n).
+  void merge(bimap &source) {
+    if (&source == this) {
+      return;
+    }
+    if (allocator != source.allocator) {
+      merge_moving(source);
+      return;
+    }
+    if (rebuild_pays(source.tree_size, tree_size + source.tree_size, 3)) {
+      merge_rebuilding(source);
+      return;
+    }
+
+    std::vector<splay_tree_t *> pairs;
+    pairs.reserve(source.tree_size);
+    for (node<left_tag, left_t> *t = walk_min(source.tree_left); t; t = walk_next(t)) {
+      pairs.push_back(get_splay_l(t));
+    }
+
+    index_reserve(tree_size + pairs.size());
+    for (splay_tree_t *pair : pairs) {
+      insert_checked(get_node_l(pair)->value, get_node_r(pair)->value, [&source, pair] {
+        source.detach_pair(pair);
+        reset_links(pair);
+        return pair;
+      });
+    }
+  }
+  void merge(bimap &&source) {
+    merge(source);
+  }
+
+  // Разделяет bimap по ключу: пары, чей left не меньше key, переносятся в
+  // возвращаемый bimap, остальные остаются в этом. Пары не копируются и
+  // обходится только меньшая из частей: O(m log n) для части из m пар, но
+  // не больше O(n). Итераторы на перенесенные пары инвалидируются.
+  bimap split_left(left_t const &key) {
+    return split_at(walk_bound<left_tag>(key, true));
+  }
+  bimap split_right(right_t const &key) {
+    return split_at(walk_bound<right_tag>(key, true));
+  }
+
+  // Обратная split_left операция: переносит все пары other в этот bimap,
+  // если left'ы other все больше или все меньше left'ов этого bimap, а его
+  // right'ы здесь не встречаются. Иначе бросает std::invalid_argument, и
+  // оба bimap не меняются. Стоит как split_left для меньшего из двух.
+  // Если аллокаторы не равны, пары other сначала копируются за O(m)
+  // аллокатором этого bimap, а для некопируемых типов бросается
+  // std::invalid_argument.
+  void join(bimap &&other) {
+    if (&other == this) {
+      return;
+    }
+    if (allocator == other.allocator) {
+      join_ordered(other);
+      return;
+    }
+
+    if constexpr (std::is_copy_constructible_v<splay_tree_t>) {
+      bimap copy(compare_left, compare_right, get_allocator());
+      copy.tree_size = other.tree_size;
+      copy.clone_trees(other);
+      copy.rebuild_indices();
+      join_ordered(copy);
+
+      bimap drained(other.compare_left, other.compare_right, other.get_allocator());
+      other.swap_trees(drained);
+    } else {
+      throw std::invalid_argument("bimap::join - allocators differ");
+    }
   }
 
   // Удаляет элемент и соответствующий ему парный.
@@ -463,24 +1903,17 @@ public:
   // Пусть it ссылается на некоторый элемент e.
   // erase инвалидирует все итераторы ссылающиеся на e и на элемент парный к e.
   left_iterator erase_left(left_iterator it) {
-    splay(it.tree);
-
-    splay_tree_t *tmp = get_splay_l(it.tree);
-    node<left_tag, left_t> *nxt = next(tree_left);
-
-    remove<left_tag>(*it);
-    remove<right_tag>(get_node_r(tmp)->value);
-
-    tree_size--;
-    delete tmp;
+    counters.erase(side_of<left_tag>);
+    node<left_tag, left_t> *nxt = next(it.tree);
+    erase_pair(get_splay_l(it.tree));
 
     return left_iterator(nxt, this);
   }
   // Аналогично erase, но по ключу, удаляет элемент если он присутствует, иначе
   // не делает ничего Возвращает была ли пара удалена
   bool erase_left(left_t const &left) {
-    node<left_tag, left_t> *t = find(tree_left, left);
-    if (!t || !equal<left_tag>(t->value, left)) {
+    node<left_tag, left_t> *t = lookup<left_tag>(left);
+    if (!t) {
       return false;
     }
 
@@ -489,22 +1922,15 @@ public:
   }
 
   right_iterator erase_right(right_iterator it) {
-    splay(it.tree);
-
-    splay_tree_t *tmp = get_splay_r(it.tree);
-    node<right_tag, right_t> *nxt = next(tree_right);
-
-    remove<left_tag>(get_node_l(tmp)->value);
-    remove<right_tag>(*it);
-
-    tree_size--;
-    delete tmp;
+    counters.erase(side_of<right_tag>);
+    node<right_tag, right_t> *nxt = next(it.tree);
+    erase_pair(get_splay_r(it.tree));
 
     return right_iterator(nxt, this);
   }
   bool erase_right(right_t const &right) {
-    node<right_tag, right_t> *t = find(tree_right, right);
-    if (!t || !equal<right_tag>(t->value, right)) {
+    node<right_tag, right_t> *t = lookup<right_tag>(right);
+    if (!t) {
       return false;
     }
 
@@ -514,59 +1940,46 @@ public:
 
   // erase от ренжа, удаляет [first, last), возвращает итератор на последний
   // элемент за удаленной последовательностью
+  // Диапазон вырезается из дерева целиком за O(log n), парные элементы
+  // удаляются из другого дерева одной пачкой.
   left_iterator erase_left(left_iterator first, left_iterator last) {
-    while(first != last) {
-      first = erase_left(first);
-    }
-
+    erase_range(first.tree, last.tree);
     return last;
   }
   right_iterator erase_right(right_iterator first, right_iterator last) {
-    while(first != last) {
-      first = erase_right(first);
-    }
-
+    erase_range(first.tree, last.tree);
     return last;
   }
 
   // Возвращает итератор по элементу. Если не найден - соответствующий end()
   left_iterator find_left(left_t const &left) const {
-    node<left_tag, left_t> *t = find(tree_left, left);
-    if (t && equal<left_tag>(t->value, left)) {
-      return left_iterator(t, this);
-    } else {
-      return end_left();
-    }
+    return left_iterator(lookup<left_tag>(left), this);
   }
   right_iterator find_right(right_t const &right) const {
-    node<right_tag, right_t> *t = find(tree_right, right);
-    if (t && equal<right_tag>(t->value, right)) {
-      return right_iterator(t, this);
-    } else {
-      return end_right();
-    }
+    return right_iterator(lookup<right_tag>(right), this);
+  }
+
+  // Поиск с подсказкой: начинается от hint (end -- от максимума) и стоит
+  // амортизированно O(log d), где d -- расстояние от hint до ключа.
+  left_iterator find_left(left_iterator hint, left_t const &left) const {
+    return left_iterator(find_hinted(hint, left), this);
+  }
+  right_iterator find_right(right_iterator hint, right_t const &right) const {
+    return right_iterator(find_hinted(hint, right), this);
   }
 
   // Возвращает противоположный элемент по элементу
   // Если элемента не существует -- бросает std::out_of_range
   right_t const &at_left(left_t const &key) const {
-    find<left_tag, left_t>(tree_left, key);
-
-    node<right_tag, right_t> *opposite_node =
-        get_node_r(get_splay_l(tree_left));
-    if (tree_left && equal<left_tag>(tree_left->value, key)) {
-      return opposite_node->value;
+    if (node<left_tag, left_t> *t = lookup<left_tag>(key)) {
+      return get_opposite<left_tag>(t)->value;
     }
     throw std::out_of_range("bimap::at_left - no such element");
   }
 
   left_t const &at_right(right_t const &key) const {
-    find<right_tag, right_t>(tree_right, key);
-
-    node<left_tag, left_t> *opposite_node =
-        get_node_l(get_splay_r(tree_right));
-    if (tree_right && equal<right_tag>(tree_right->value, key)) {
-      return opposite_node->value;
+    if (node<right_tag, right_t> *t = lookup<right_tag>(key)) {
+      return get_opposite<right_tag>(t)->value;
     }
     throw std::out_of_range("bimap::at_right - no such element");
   }
@@ -578,49 +1991,71 @@ public:
   // соответствующий ему элемент на запрашиваемый (смотри тесты)
   template <typename T = right_t, std::enable_if_t<std::is_default_constructible_v<T>, int> = 0>
   right_t const &at_left_or_default(left_t const &key) {
-    find<left_tag, left_t>(tree_left, key);
-    node<right_tag, right_t> *opposite_node =
-        get_node_r(get_splay_l(tree_left));
-
-    if (tree_left) {
-      if (equal<left_tag>(tree_left->value, key)) {
-        return opposite_node->value;
-      } else {
-        right_t value = right_t();
-        find<right_tag, right_t>(tree_right, value);
-        if (equal<right_tag>(tree_right->value, value)) {
-          erase_right(right_iterator(tree_right, this));
-        }
-        insert(key, std::move(value));
-      }
-    } else {
-      insert(key, right_t());
+    if (node<left_tag, left_t> *t = lookup<left_tag>(key)) {
+      return get_opposite<left_tag>(t)->value;
     }
 
-    return get_node_r(get_splay_l(find<left_tag, left_t>(tree_left, key)))->value;
+    right_t value = right_t();
+    if (node<right_tag, right_t> *t = lookup<right_tag>(value)) {
+      erase_right(right_iterator(t, this));
+    }
+    return get_opposite<left_tag>(insert(key, std::move(value)).tree)->value;
   }
 
   template <typename T = left_t , std::enable_if_t<std::is_default_constructible_v<T>, int> = 0>
   left_t const &at_right_or_default(right_t const &key) {
-    find<right_tag, right_t>(tree_right, key);
-    node<left_tag, left_t> *opposite_node = get_node_l(get_splay_r(tree_right));
+    if (node<right_tag, right_t> *t = lookup<right_tag>(key)) {
+      return get_opposite<right_tag>(t)->value;
+    }
 
-    if (tree_right) {
-      if (equal<right_tag>(tree_right->value, key)) {
-        return opposite_node->value;
-      } else {
-        left_t value = left_t();
-        find<left_tag, left_t>(tree_left, value);
-        if (equal<left_tag>(tree_left->value, value)) {
-          erase_left(left_iterator(tree_left, this));
-        }
-        insert(std::move(value), key);
-      }
-    } else {
-      insert(left_t(), key);
+    left_t value = left_t();
+    if (node<left_tag, left_t> *t = lookup<left_tag>(value)) {
+      erase_left(left_iterator(t, this));
+    }
+    return insert(std::move(value), key).tree->value;
+  }
+
+  // Пакетный поиск: для каждого ключа из [first, last) записывает в out
+  // итератор на него или end, в порядке ключей. Ключи сортируются и ищутся
+  // от предыдущего ответа, деревья при этом не перестраиваются.
+  template <typename ForwardIt, typename OutputIt>
+  OutputIt find_left_batch(ForwardIt first, ForwardIt last, OutputIt out) const {
+    for (node<left_tag, left_t> *t : batch_lookup<left_tag>(first, last)) {
+      *out++ = left_iterator(t, this);
     }
+    return out;
+  }
+  template <typename ForwardIt, typename OutputIt>
+  OutputIt find_right_batch(ForwardIt first, ForwardIt last, OutputIt out) const {
+    for (node<right_tag, right_t> *t : batch_lookup<right_tag>(first, last)) {
+      *out++ = right_iterator(t, this);
+    }
+    return out;
+  }
 
-    return get_node_l(get_splay_r(find<right_tag, right_t>(tree_right, key)))->value;
+  // Пакетный at: записывает в out противоположные элементы в порядке ключей.
+  // Если какого-то ключа нет, бросает std::out_of_range, ничего не записав.
+  template <typename ForwardIt, typename OutputIt>
+  OutputIt at_left_batch(ForwardIt first, ForwardIt last, OutputIt out) const {
+    std::vector<node<left_tag, left_t> *> found = batch_lookup<left_tag>(first, last);
+    if (std::find(found.begin(), found.end(), nullptr) != found.end()) {
+      throw std::out_of_range("bimap::at_left_batch - no such element");
+    }
+    for (node<left_tag, left_t> *t : found) {
+      *out++ = get_opposite<left_tag>(t)->value;
+    }
+    return out;
+  }
+  template <typename ForwardIt, typename OutputIt>
+  OutputIt at_right_batch(ForwardIt first, ForwardIt last, OutputIt out) const {
+    std::vector<node<right_tag, right_t> *> found = batch_lookup<right_tag>(first, last);
+    if (std::find(found.begin(), found.end(), nullptr) != found.end()) {
+      throw std::out_of_range("bimap::at_right_batch - no such element");
+    }
+    for (node<right_tag, right_t> *t : found) {
+      *out++ = get_opposite<right_tag>(t)->value;
+    }
+    return out;
   }
 
   // lower и upper bound'ы по каждой стороне
@@ -640,9 +2075,89 @@ public:
     return bound_operation<right_tag, right_t>(right, false);
   }
 
+  // Порядковые статистики по подсчитанным размерам поддеревьев, за
+  // O(log n) (для splay -- амортизированно).
+  // nth -- итератор на k-й по возрастанию элемент стороны (с нуля),
+  // end, если k >= size().
+  left_iterator nth_left(std::size_t k) const {
+    return nth_operation<left_tag>(k);
+  }
+  right_iterator nth_right(std::size_t k) const {
+    return nth_operation<right_tag>(k);
+  }
+
+  // rank -- количество элементов стороны, меньших key,
+  // или номер элемента под итератором (size() для end).
+  std::size_t rank_left(left_t const &key) const {
+    return rank_operation<left_tag>(key);
+  }
+  std::size_t rank_right(right_t const &key) const {
+    return rank_operation<right_tag>(key);
+  }
+  std::size_t rank_left(left_iterator it) const {
+    return position(it.tree);
+  }
+  std::size_t rank_right(right_iterator it) const {
+    return position(it.tree);
+  }
+
+  // То же, что std::distance(first, last), но за O(log n), а не за
+  // количество шагов между итераторами.
+  std::ptrdiff_t distance(left_iterator first, left_iterator last) const {
+    return static_cast<std::ptrdiff_t>(rank_left(last)) - static_cast<std::ptrdiff_t>(rank_left(first));
+  }
+  std::ptrdiff_t distance(right_iterator first, right_iterator last) const {
+    return static_cast<std::ptrdiff_t>(rank_right(last)) - static_cast<std::ptrdiff_t>(rank_right(first));
+  }
+
+  // Поиск и bound'ы по значению другого типа, сравнимому с left_t (right_t),
+  // без создания временного ключа. Доступны, если компаратор стороны
+  // прозрачный, например std::less<>.
+  template <typename K, typename C = CompareLeft, typename = typename C::is_transparent>
+  left_iterator find_left(K const &left) const {
+    return left_iterator(lookup<left_tag>(left), this);
+  }
+  template <typename K, typename C = CompareRight, typename = typename C::is_transparent>
+  right_iterator find_right(K const &right) const {
+    return right_iterator(lookup<right_tag>(right), this);
+  }
+
+  template <typename K, typename C = CompareLeft, typename = typename C::is_transparent>
+  right_t const &at_left(K const &key) const {
+    if (node<left_tag, left_t> *t = lookup<left_tag>(key)) {
+      return get_opposite<left_tag>(t)->value;
+    }
+    throw std::out_of_range("bimap::at_left - no such element");
+  }
+  template <typename K, typename C = CompareRight, typename = typename C::is_transparent>
+  left_t const &at_right(K const &key) const {
+    if (node<right_tag, right_t> *t = lookup<right_tag>(key)) {
+      return get_opposite<right_tag>(t)->value;
+    }
+    throw std::out_of_range("bimap::at_right - no such element");
+  }
+
+  template <typename K, typename C = CompareLeft, typename = typename C::is_transparent>
+  left_iterator lower_bound_left(K const &left) const {
+    return bound_operation<left_tag>(left, true);
+  }
+  template <typename K, typename C = CompareLeft, typename = typename C::is_transparent>
+  left_iterator upper_bound_left(K const &left) const {
+    return bound_operation<left_tag>(left, false);
+  }
+
+  template <typename K, typename C = CompareRight, typename = typename C::is_transparent>
+  right_iterator lower_bound_right(K const &right) const {
+    return bound_operation<right_tag>(right, true);
+  }
+  template <typename K, typename C = CompareRight, typename = typename C::is_transparent>
+  right_iterator upper_bound_right(K const &right) const {
+    return bound_operation<right_tag>(right, false);
+  }
+
   // Возващает итератор на минимальный по порядку left.
   left_iterator begin_left() const {
-    return left_iterator(find_min(tree_left), this);
+    return left_iterator(set_tree_root(walk_min(tree_left)), this);
   }
   // Возващает итератор на следующий за последним по порядку left.
   left_iterator end_left() const {
@@ -651,7 +2166,7 @@ public:
 
   // Возващает итератор на минимальный по порядку right.
   right_iterator begin_right() const {
-    return right_iterator(find_min(tree_right), this);
+    return right_iterator(set_tree_root(walk_min(tree_right)), this);
   }
   // Возващает итератор на следующий за последним по порядку right.
   right_iterator end_right() const {
@@ -668,21 +2183,39 @@ public:
     return tree_size;
   }
 
+  // Счетчики операций с создания bimap или последнего reset_stats
+  // (см. stats_policy.h) и текущие высоты деревьев. Без считающей политики
+  // Stats счетчики нулевые. Высоты считаются обходом за O(n), деревья при
+  // этом не перестраиваются.
+  bimap_stats stats() const {
+    bimap_stats res = counters.snapshot();
+    res.left.height = tree_height(tree_left);
+    res.right.height = tree_height(tree_right);
+    return res;
+  }
+
+  void reset_stats() {
+    counters.reset();
+  }
+
   // операторы сравнения
+  // Обходит оба bimap по родительским ссылкам, не перестраивая деревья,
+  // сравнивает размеры, затем левые ключи и парные им правые.
   bool operator==(bimap const &b) const {
     if (tree_size != b.tree_size) {
       return false;
     }
+    if (this == &b) {
+      return true;
+    }
 
-    left_iterator l1 = begin_left();
-    left_iterator l2 = b.begin_left();
-
-    while (l1 != end_left()) {
-      if (!equal<left_tag>(*l1, *l2) || !equal<right_tag>(*l1.flip(), *l2.flip())) {
+    node<left_tag, left_t> *t1 = walk_min(tree_left);
+    node<left_tag, left_t> *t2 = walk_min(b.tree_left);
+    for (; t1; t1 = walk_next(t1), t2 = walk_next(t2)) {
+      if (!equal<left_tag>(t1->value, t2->value) ||
+          !equal<right_tag>(get_opposite<left_tag>(t1)->value, get_opposite<left_tag>(t2)->value)) {
         return false;
       }
-      l1++;
-      l2++;
     }
     return true;
   }
@@ -696,37 +2229,657 @@ private:
 
     swap(tree_left, second.tree_left);
     swap(tree_right, second.tree_right);
+    swap(compare_left, second.compare_left);
+    swap(compare_right, second.compare_right);
+    swap(allocator, second.allocator);
+    if constexpr (hashed<left_tag>) {
+      index_left.swap(second.index_left);
+    }
+    if constexpr (hashed<right_tag>) {
+      index_right.swap(second.index_right);
+    }
     swap(tree_size, second.tree_size);
   }
 
-  template <typename Tag, typename T>
-  auto bound_operation(T const &value, bool lower_bound) const {
-    node<Tag, T> *tree = find(get_root<Tag, T>(), value);
-    if (!tree) {
-      tree = next<Tag, T>(value);
+  /**
+   * descends once, remembering the answer, and splays the last visited node
+   */
+  template <typename Tag, typename K>
+  auto bound_operation(K const &value, bool lower_bound) const {
+    using T = value_t<Tag>;
+    counters.bound(side_of<Tag>);
+    node<Tag, T> *t = get_root<Tag, T>();
+    node<Tag, T> *res = nullptr;
+    node<Tag, T> *last = nullptr;
+
+    while (t) {
+      last = t;
+      if (lower_bound ? !less<Tag>(t->value, value)
+                      : less<Tag>(value, t->value)) {
+        res = t;
+        t = t->left;
+      } else {
+        t = t->right;
+      }
+    }
+
+    if (last) {
+      set_tree_root(last);
+    }
+    return iterator<Tag, T>(res, this);
+  }
+
+  /**
+   * @return iterator on the k-th (from 0) node, end if k >= size,
+   * splays the found node
+   */
+  template <typename Tag>
+  auto nth_operation(std::size_t k) const {
+    using T = value_t<Tag>;
+    node<Tag, T> *t = walk_nth(get_root<Tag, T>(), k);
+    if (t) {
+      set_tree_root(t);
     }
+    return iterator<Tag, T>(t, this);
+  }
+
+  /**
+   * number of nodes less than value, descends once like bound_operation
+   * and splays the last visited node
+   */
+  template <typename Tag, typename K>
+  std::size_t rank_operation(K const &value) const {
+    using T = value_t<Tag>;
+    node<Tag, T> *t = get_root<Tag, T>();
+    node<Tag, T> *last = nullptr;
+    std::size_t res = 0;
 
-    if (tree && (lower_bound ? less<Tag>(tree->value, value) :
-        (less<Tag>(tree->value, value) || equal<Tag>(tree->value, value)))) {
-      return iterator<Tag, T>(next(tree), this);
+    while (t) {
+      last = t;
+      if (less<Tag>(t->value, value)) {
+        res += node<Tag, T>::size_of(t->left) + 1;
+        t = t->right;
+      } else {
+        t = t->left;
+      }
     }
 
-    return iterator<Tag, T>(tree, this);
+    if (last) {
+      set_tree_root(last);
+    }
+    return res;
   }
 
+  /**
+   * @return number of nodes before t, size for end
+   */
   template <typename Tag, typename T>
-  iterator<Tag, T> insert_operation(splay_tree_t *new_node) {
+  std::size_t position(node<Tag, T> *t) const {
+    if (!t) {
+      return tree_size;
+    }
+
+    // a splayed node is the root, balanced trees climb O(log n) links
+    t = set_tree_root(t);
+    std::size_t res = node<Tag, T>::size_of(t->left);
+    for (; t->parent; t = t->parent) {
+      if (t->parent->right == t) {
+        res += node<Tag, T>::size_of(t->parent->left) + 1;
+      }
+    }
+    return res;
+  }
+
+  /**
+   * finding the neighbours of left and right doubles as the duplicate check,
+   * only then make() builds the new pair, which is linked right next to them
+   */
+  template <typename KL, typename KR, typename Make>
+  std::pair<left_iterator, bool> insert_checked(KL const &left, KR const &right, Make make,
+                                                node<left_tag, left_t> *left_finger = nullptr,
+                                                node<right_tag, right_t> *right_finger = nullptr) {
+    counters.insert();
+    node<left_tag, left_t> *l = find_closest<left_tag>(left, left_finger);
+    if (l && equal<left_tag>(l->value, left)) {
+      return {left_iterator(l, this), false};
+    }
+
+    node<right_tag, right_t> *r = find_closest<right_tag>(right, right_finger);
+    if (r && equal<right_tag>(r->value, right)) {
+      return {left_iterator(get_opposite<right_tag>(r), this), false};
+    }
+
+    index_reserve(tree_size + 1);
+    splay_tree_t *new_node = make();
+    link_closest(l, get_node_l(new_node));
+    link_closest(r, get_node_r(new_node));
+    index_insert(new_node);
     tree_size++;
-    insert_both_trees(new_node);
-    return iterator<Tag, T>(new_node, this);
+
+    return {left_iterator(get_node_l(new_node), this), true};
+  }
+
+  template <typename L, typename R>
+  std::pair<left_iterator, bool> insert_unique(L &&left, R &&right) {
+    return insert_checked(left, right, [&] {
+      return create_node(std::forward<L>(left), std::forward<R>(right));
+    });
+  }
+
+  /**
+   * both searches start from the pair of hint, end() hints the maximum
+   */
+  template <typename Tag, typename T, typename L, typename R>
+  std::pair<left_iterator, bool> insert_hinted(iterator<Tag, T> hint, L &&left, R &&right) {
+    node<Tag, T> *finger = hint.tree ? hint.tree : walk_max(get_root<Tag, T>());
+    node_t<opposite_t<Tag>> *opposite_finger = finger ? get_opposite<Tag>(finger) : nullptr;
+
+    auto make = [&] {
+      return create_node(std::forward<L>(left), std::forward<R>(right));
+    };
+    if constexpr (std::is_same_v<Tag, left_tag>) {
+      return insert_checked(left, right, make, finger, opposite_finger);
+    } else {
+      return insert_checked(left, right, make, opposite_finger, finger);
+    }
+  }
+
+  /**
+   * finger search from hint, the found or the last visited node is splayed
+   */
+  template <typename Tag, typename T>
+  node<Tag, T> *find_hinted(iterator<Tag, T> hint, T const &value) const {
+    if constexpr (hashed<Tag>) {
+      return lookup<Tag>(value);
+    } else {
+      counters.find(side_of<Tag>);
+      node<Tag, T> *finger = hint.tree ? hint.tree : walk_max(get_root<Tag, T>());
+      node<Tag, T> *found = walk_finger<Tag>(finger, value);
+      if (finger) {
+        if constexpr (Stats::enabled) {
+          counters.find_depth(side_of<Tag>, depth_of(found ? found : finger));
+        }
+        set_tree_root(found ? found : finger);
+      }
+      return found;
+    }
+  }
+
+  /**
+   * K can be compared with Tag values without building a value_t from it
+   */
+  template <typename Tag, typename K>
+  static constexpr bool comparable_key =
+      std::is_same_v<std::remove_cv_t<std::remove_reference_t<K>>, value_t<Tag>> ||
+      is_transparent<std::conditional_t<std::is_same_v<Tag, left_tag>, CompareLeft, CompareRight>>::value;
+
+  left_iterator insert_result(std::pair<left_iterator, bool> const &res) const {
+    return res.second ? res.first : end_left();
+  }
+
+  /**
+   * takes pair out of both trees, pair stays allocated
+   */
+  void detach_pair(splay_tree_t *pair) {
+    index_erase(pair);
+    unlink(get_node_l(pair));
+    unlink(get_node_r(pair));
+
+    tree_size--;
+  }
+
+  void erase_pair(splay_tree_t *pair) {
+    detach_pair(pair);
+    destroy_node(pair);
+  }
+
+  /**
+   * new pair of this allocator with the values of a pair of another one,
+   * values are copied when moving them could throw
+   */
+  splay_tree_t *create_moved(splay_tree_t *pair) {
+    return create_node(std::move_if_noexcept(get_node_l(pair)->value),
+                       std::move_if_noexcept(get_node_r(pair)->value));
+  }
+
+  /**
+   * clears links left from the tree pair was detached from
+   */
+  template <typename Tag, typename T>
+  static void reset_links(node<Tag, T> *t) {
+    t->parent = t->left = t->right = nullptr;
+    static_cast<node_data &>(*t) = node_data();
+    t->size = 1;
+  }
+  static void reset_links(splay_tree_t *pair) {
+    reset_links(get_node_l(pair));
+    reset_links(get_node_r(pair));
+  }
+
+  /**
+   * cuts [first, last) out of the splay tree with two splays
+   */
+  template <typename Tag, typename T>
+  void cut_range(node<Tag, T> *first, node<Tag, T> *last) const {
+    set_tree_root(first);
+    node<Tag, T> *smaller = first->left;
+    first->left = nullptr;
+    first->update_size();
+    if (smaller) {
+      smaller->parent = nullptr;
+    }
+
+    node<Tag, T> *bigger = nullptr;
+    if (last) {
+      set_tree_root(last);
+      bigger = last;
+      last->left->parent = nullptr;
+      last->left = nullptr;
+      last->update_size();
+    }
+    merge(smaller, bigger);
+  }
+
+  /**
+   * erases pairs [first, last) of the Tag tree: the range is cut out of it
+   * with two splays, the opposite tree either unlinks every partner or, when
+   * the range is a large part of the map, is rebuilt from the survivors.
+   * Balanced trees can't be cut, so they unlink or rebuild both sides
+   */
+  template <typename Tag, typename T>
+  void erase_range(node<Tag, T> *first, node<Tag, T> *last) {
+    if (first == last) {
+      return;
+    }
+
+    // all allocations happen before the trees are touched
+    std::vector<splay_tree_t *> erased;
+    for (node<Tag, T> *t = first; t != last; t = walk_next(t)) {
+      erased.push_back(get_splay<Tag, left_t, right_t>(t));
+    }
+    counters.erase(side_of<Tag>, erased.size());
+
+    bool rebuild = rebuild_pays(erased.size(), tree_size);
+
+    std::vector<splay_tree_t *> kept;
+    if (rebuild) {
+      kept.reserve(tree_size - erased.size());
+    }
+
+    if constexpr (!self_adjusting) {
+      if (!rebuild) {
+        for (splay_tree_t *pair : erased) {
+          unlink(get_node_l(pair));
+          unlink(get_node_r(pair));
+        }
+      } else {
+        // balanced trees can't be cut with splays, the Tag tree is rebuilt too
+        for (node<Tag, T> *t = walk_min(get_root<Tag, T>()); t != first; t = walk_next(t)) {
+          kept.push_back(get_splay<Tag, left_t, right_t>(t));
+        }
+        for (node<Tag, T> *t = last; t; t = walk_next(t)) {
+          kept.push_back(get_splay<Tag, left_t, right_t>(t));
+        }
+        get_root<Tag, T>() = build_balanced<Tag>(kept.data(), kept.size(), nullptr);
+        kept.clear();
+      }
+    } else {
+      cut_range(first, last);
+    }
+
+    using opposite_tag = opposite_t<Tag>;
+    if (rebuild) {
+      // Tag links of erased pairs are free now, self parent marks them
+      for (splay_tree_t *pair : erased) {
+        node<Tag, T> *t = pair;
+        t->parent = t;
+      }
+      for (node_t<opposite_tag> *t = walk_min(get_root<opposite_tag, value_t<opposite_tag>>());
+           t; t = walk_next(t)) {
+        splay_tree_t *pair = get_splay<opposite_tag, left_t, right_t>(t);
+        node<Tag, T> *mark = pair;
+        if (mark->parent != mark) {
+          kept.push_back(pair);
+        }
+      }
+      get_root<opposite_tag, value_t<opposite_tag>>() =
+          build_balanced<opposite_tag>(kept.data(), kept.size(), nullptr);
+    } else if constexpr (self_adjusting) {
+      for (splay_tree_t *pair : erased) {
+        unlink(static_cast<node_t<opposite_tag> *>(pair));
+      }
+    }
+
+    tree_size -= erased.size();
+    for (splay_tree_t *pair : erased) {
+      index_erase(pair);
+      destroy_node(pair);
+    }
+  }
+
+  /**
+   * moving count pairs of a map of size pairs one by one costs
+   * O(count log size), rebuilding the trees in passes walks over them costs
+   * O(passes * size)
+   */
+  static bool rebuild_pays(std::size_t count, std::size_t size, std::size_t passes = 1) {
+    std::size_t log_size = 1;
+    for (std::size_t n = size; n > 1; n >>= 1) {
+      log_size++;
+    }
+    return count * log_size >= passes * size;
+  }
+
+  /**
+   * walks the Tag trees of this and source in one sorted pass, calls
+   * own(pair) for pairs of this and other(pair, taken) for pairs of source,
+   * taken tells if this has a pair with an equal Tag value
+   */
+  template <typename Tag, typename Own, typename Other>
+  void merge_walk(bimap const &source, Own own, Other other) const {
+    using T = value_t<Tag>;
+    node<Tag, T> *a = walk_min(get_root<Tag, T>());
+    node<Tag, T> *b = walk_min(source.get_root<Tag, T>());
+
+    while (a || b) {
+      if (!b || (a && less<Tag>(a->value, b->value))) {
+        own(get_splay<Tag, left_t, right_t>(a));
+        a = walk_next(a);
+      } else if (!a || less<Tag>(b->value, a->value)) {
+        other(get_splay<Tag, left_t, right_t>(b), false);
+        b = walk_next(b);
+      } else {
+        own(get_splay<Tag, left_t, right_t>(a));
+        other(get_splay<Tag, left_t, right_t>(b), true);
+        a = walk_next(a);
+        b = walk_next(b);
+      }
+    }
+  }
+
+  /**
+   * moves pairs from first on in the Tag order into a new bimap. Only the
+   * smaller part of m pairs is walked: its opposite nodes are unlinked one
+   * by one and linked into a balanced tree, the Tag tree of a splay policy
+   * is cut with one splay. When that costs more than O(n), all four trees
+   * are rebuilt instead
+   */
+  template <typename Tag, typename T>
+  bimap split_at(node<Tag, T> *first) {
+    using opposite_tag = opposite_t<Tag>;
+    bimap res(compare_left, compare_right, allocator);
+    if (!first) {
+      return res;
+    }
+
+    std::size_t rank = position(first);
+    bool upper_small = tree_size - rank <= rank;
+
+    // all allocations happen before the trees are touched
+    std::vector<splay_tree_t *> small;
+    small.reserve(upper_small ? tree_size - rank : rank);
+    for (node<Tag, T> *t = upper_small ? first : walk_min(get_root<Tag, T>());
+         t != (upper_small ? nullptr : first); t = walk_next(t)) {
+      small.push_back(get_splay<Tag, left_t, right_t>(t));
+    }
+    res.index_reserve(small.size());
+
+    node<Tag, T> *small_root = nullptr;
+    node_t<opposite_tag> *small_opposite = nullptr;
+    if (rebuild_pays(small.size(), tree_size, 3)) {
+      std::vector<splay_tree_t *> big;
+      std::vector<splay_tree_t *> small_by_opposite;
+      big.reserve(tree_size - small.size());
+      small_by_opposite.reserve(small.size());
+      for (node<Tag, T> *t = upper_small ? walk_min(get_root<Tag, T>()) : first;
+           t != (upper_small ? first : nullptr); t = walk_next(t)) {
+        big.push_back(get_splay<Tag, left_t, right_t>(t));
+      }
+      T const &bound = first->value;
+      std::vector<splay_tree_t *> big_by_opposite;
+      big_by_opposite.reserve(big.size());
+      for (node_t<opposite_tag> *t = walk_min(get_root<opposite_tag, value_t<opposite_tag>>());
+           t; t = walk_next(t)) {
+        splay_tree_t *pair = get_splay<opposite_tag, left_t, right_t>(t);
+        node<Tag, T> *mine = pair;
+        bool upper = !less<Tag>(mine->value, bound);
+        (upper == upper_small ? small_by_opposite : big_by_opposite).push_back(pair);
+      }
+
+      get_root<Tag, T>() = build_balanced<Tag>(big.data(), big.size(), nullptr);
+      get_root<opposite_tag, value_t<opposite_tag>>() =
+          build_balanced<opposite_tag>(big_by_opposite.data(), big_by_opposite.size(), nullptr);
+      small_root = build_balanced<Tag>(small.data(), small.size(), nullptr);
+      small_opposite = build_balanced<opposite_tag>(small_by_opposite.data(),
+                                                    small_by_opposite.size(), nullptr);
+    } else {
+      std::vector<splay_tree_t *> small_by_opposite(small);
+      std::sort(small_by_opposite.begin(), small_by_opposite.end(),
+                [this](splay_tree_t *a, splay_tree_t *b) {
+        return less<opposite_tag>(static_cast<node_t<opposite_tag> *>(a)->value,
+                                  static_cast<node_t<opposite_tag> *>(b)->value);
+      });
+
+      if constexpr (self_adjusting) {
+        set_tree_root(first);
+        node<Tag, T> *lower = first->left;
+        first->left = nullptr;
+        first->update_size();
+        if (lower) {
+          lower->parent = nullptr;
+        }
+        small_root = upper_small ? first : lower;
+        get_root<Tag, T>() = upper_small ? lower : first;
+      } else {
+        for (splay_tree_t *pair : small) {
+          unlink(static_cast<node<Tag, T> *>(pair));
+        }
+        small_root = build_balanced<Tag>(small.data(), small.size(), nullptr);
+      }
+      for (splay_tree_t *pair : small) {
+        unlink(static_cast<node_t<opposite_tag> *>(pair));
+      }
+      small_opposite = build_balanced<opposite_tag>(small_by_opposite.data(),
+                                                    small_by_opposite.size(), nullptr);
+    }
+
+    // res takes the small part, or everything but it
+    res.get_root<Tag, T>() = small_root;
+    res.get_root<opposite_tag, value_t<opposite_tag>>() = small_opposite;
+    res.tree_size = small.size();
+    tree_size -= small.size();
+    bimap *from = this;
+    bimap *to = &res;
+    if (!upper_small) {
+      swap_trees(res);
+      std::swap(from, to);
+    }
+    for (splay_tree_t *pair : small) {
+      from->index_erase(pair);
+      to->index_insert(pair);
+    }
+    return res;
+  }
+
+  /**
+   * merges source of another allocator: its nodes can't be relinked, so
+   * the values go to new nodes and the old ones are freed by source
+   */
+  void merge_moving(bimap &source) {
+    std::vector<splay_tree_t *> pairs;
+    pairs.reserve(source.tree_size);
+    for (node<left_tag, left_t> *t = walk_min(source.tree_left); t; t = walk_next(t)) {
+      pairs.push_back(get_splay_l(t));
+    }
+
+    index_reserve(tree_size + pairs.size());
+    for (splay_tree_t *pair : pairs) {
+      auto res = insert_checked(get_node_l(pair)->value, get_node_r(pair)->value,
+                                [this, pair] { return create_moved(pair); });
+      if (res.second) {
+        source.erase_pair(pair);
+      }
+    }
+  }
+
+  /**
+   * merges source by three sorted walks and rebuilds the trees of both
+   * bimaps, O(n + m) instead of m searches
+   */
+  void merge_rebuilding(bimap &source) {
+    // pairs of source whose left or right is taken here stay in source
+    std::unordered_set<splay_tree_t const *> kept;
+    merge_walk<left_tag>(source, [](splay_tree_t *) {}, [&kept](splay_tree_t *pair, bool taken) {
+      if (taken) {
+        kept.insert(pair);
+      }
+    });
+
+    std::vector<splay_tree_t *> by_right;
+    std::vector<splay_tree_t *> kept_by_right;
+    by_right.reserve(tree_size + source.tree_size);
+    merge_walk<right_tag>(source, [&by_right](splay_tree_t *pair) { by_right.push_back(pair); },
+                          [&](splay_tree_t *pair, bool taken) {
+      if (taken || kept.count(pair)) {
+        kept.insert(pair);
+        kept_by_right.push_back(pair);
+      } else {
+        by_right.push_back(pair);
+      }
+    });
+
+    std::vector<splay_tree_t *> by_left;
+    std::vector<splay_tree_t *> kept_by_left;
+    std::vector<splay_tree_t *> moved;
+    by_left.reserve(by_right.size());
+    merge_walk<left_tag>(source, [&by_left](splay_tree_t *pair) { by_left.push_back(pair); },
+                         [&](splay_tree_t *pair, bool) {
+      if (kept.count(pair)) {
+        kept_by_left.push_back(pair);
+      } else {
+        by_left.push_back(pair);
+        moved.push_back(pair);
+      }
+    });
+    index_reserve(by_left.size());
+
+    tree_left = build_balanced<left_tag>(by_left.data(), by_left.size(), nullptr);
+    tree_right = build_balanced<right_tag>(by_right.data(), by_right.size(), nullptr);
+    tree_size = by_left.size();
+    source.tree_left = build_balanced<left_tag>(kept_by_left.data(), kept_by_left.size(), nullptr);
+    source.tree_right = build_balanced<right_tag>(kept_by_right.data(), kept_by_right.size(), nullptr);
+    source.tree_size = kept_by_left.size();
+    for (splay_tree_t *pair : moved) {
+      source.index_erase(pair);
+      index_insert(pair);
+    }
+  }
+
+  /**
+   * takes all pairs of other, whose lefts lie on one side of the lefts of
+   * this. The pairs of the smaller map are linked into the bigger one, left
+   * splay trees are joined with one splay; when that costs more than O(n),
+   * both trees are rebuilt. Everything is checked before the trees change
+   */
+  void join_ordered(bimap &other) {
+    if (other.tree_size == 0) {
+      return;
+    }
+    if (tree_size == 0) {
+      swap_trees(other);
+      return;
+    }
+
+    bool other_after = less<left_tag>(walk_max(tree_left)->value, walk_min(other.tree_left)->value);
+    if (!other_after && !less<left_tag>(walk_max(other.tree_left)->value, walk_min(tree_left)->value)) {
+      throw std::invalid_argument("bimap::join - lefts overlap");
+    }
+
+    std::size_t size = tree_size + other.tree_size;
+    bimap &big = tree_size >= other.tree_size ? *this : other;
+    bimap &small = tree_size >= other.tree_size ? other : *this;
+    std::vector<splay_tree_t *> moved;
+    moved.reserve(small.tree_size);
+    for (node<left_tag, left_t> *t = walk_min(small.tree_left); t; t = walk_next(t)) {
+      moved.push_back(get_splay_l(t));
+    }
+
+    bool rebuild = rebuild_pays(moved.size(), size, 3);
+    std::vector<splay_tree_t *> by_left;
+    std::vector<splay_tree_t *> by_right;
+    if (rebuild) {
+      by_left.reserve(size);
+      for (bimap *part : {other_after ? this : &other, other_after ? &other : this}) {
+        for (node<left_tag, left_t> *t = walk_min(part->tree_left); t; t = walk_next(t)) {
+          by_left.push_back(get_splay_l(t));
+        }
+      }
+      by_right.reserve(size);
+      merge_walk<right_tag>(other, [&by_right](splay_tree_t *pair) { by_right.push_back(pair); },
+                            [&by_right](splay_tree_t *pair, bool taken) {
+        if (taken) {
+          throw std::invalid_argument("bimap::join - rights are not unique");
+        }
+        by_right.push_back(pair);
+      });
+    } else {
+      for (splay_tree_t *pair : moved) {
+        if (big.walk_find<right_tag>(get_node_r(pair)->value)) {
+          throw std::invalid_argument("bimap::join - rights are not unique");
+        }
+      }
+    }
+    big.index_reserve(size);
+
+    // this keeps the bigger trees, other the smaller ones
+    if (&big == &other) {
+      swap_trees(other);
+      other_after = !other_after;
+    }
+    if (rebuild) {
+      tree_left = build_balanced<left_tag>(by_left.data(), by_left.size(), nullptr);
+      tree_right = build_balanced<right_tag>(by_right.data(), by_right.size(), nullptr);
+    } else {
+      if constexpr (self_adjusting) {
+        merge(other_after ? tree_left : other.tree_left, other_after ? other.tree_left : tree_left);
+      } else {
+        for (splay_tree_t *pair : moved) {
+          node<left_tag, left_t> *l = get_node_l(pair);
+          link_closest(find_closest<left_tag>(l->value), l);
+        }
+      }
+      for (splay_tree_t *pair : moved) {
+        node<right_tag, right_t> *r = get_node_r(pair);
+        reset_links(r);
+        link_closest(find_closest<right_tag>(r->value), r);
+      }
+    }
+
+    for (splay_tree_t *pair : moved) {
+      other.index_erase(pair);
+      index_insert(pair);
+    }
+    tree_size = size;
+    other.tree_left = nullptr;
+    other.tree_right = nullptr;
+    other.tree_size = 0;
   }
 
-  bool contains(left_t const &left, right_t const &right) {
-    node<left_tag, left_t> *left_find = find<left_tag, left_t>(tree_left, left);
-    node<right_tag, right_t> *right_find = find<right_tag, right_t>(tree_right, right);
+  /**
+   * exchanges pairs with other, comparators and allocators stay
+   */
+  void swap_trees(bimap &other) noexcept {
+    using std::swap;
 
-    return (left_find && equal<left_tag>(left_find->value, left)) ||
-           (right_find && equal<right_tag>(right_find->value,right));
+    swap(tree_left, other.tree_left);
+    swap(tree_right, other.tree_right);
+    if constexpr (hashed<left_tag>) {
+      index_left.swap(other.index_left);
+    }
+    if constexpr (hashed<right_tag>) {
+      index_right.swap(other.index_right);
+    }
+    swap(tree_size, other.tree_size);
   }
 
   template <typename Tag, typename T>
@@ -738,20 +2891,20 @@ private:
     }
   }
 
+  /**
+   * splays t to the root, does nothing for balanced policies
+   */
   template <typename Tag, typename T>
   node<Tag, T> *set_tree_root(node<Tag, T>* t) const {
-    if constexpr (std::is_same_v<Tag, left_tag>) {
+    if constexpr (!self_adjusting) {
+      return t;
+    } else if constexpr (std::is_same_v<Tag, left_tag>) {
       return tree_left = splay(t);
     } else {
       return tree_right = splay(t);;
     }
   }
 
-  void insert_both_trees(splay_tree_t *node_new) {
-    insert<left_tag>(get_node_l(node_new));
-    insert<right_tag>(get_node_r(node_new));
-  }
-
   template <typename Tag, typename T>
   static auto *get_opposite(node<Tag, T> *t) {
     if constexpr (std::is_same_v<Tag, left_tag>) {
@@ -768,6 +2921,12 @@ private:
 
   CompareLeft compare_left;
   CompareRight compare_right;
+  node_allocator_t allocator;
+  // hash indices of sides enabled by HashIndex, trees stay the primary order
+  index_t<left_tag> index_left;
+  index_t<right_tag> index_right;
+  // operation counters, empty unless Stats counts (see stats_policy.h)
+  mutable Stats counters;
 
   size_t tree_size;
 };
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+/**
+ * Binary format of a saved bimap, pointer free and in native byte order:
+ * the header, then four sections, each at an offset aligned to 16 bytes:
+ *   lefts in increasing order,
+ *   rights of the same pairs in the same order,
+ *   rights in increasing order,
+ *   rank of the left of each of those rights (uint32_t).
+ * Both orders are stored, so loading needs no sorting and a mapped file is
+ * searched in place.
+ */
+struct bimap_file_header {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t byte_order;
+  std::uint32_t left_size;
+  std::uint32_t right_size;
+  std::uint64_t count;
+};
+
+/**
+ * offsets of the sections for count pairs of given sizes
+ */
+struct bimap_file_layout {
+  static constexpr char magic[8] = {'B', 'I', 'M', 'A', 'P', 0, 0, 0};
+  static constexpr std::uint32_t version = 1;
+  static constexpr std::uint32_t byte_order = 0x01020304;
+  static constexpr std::size_t alignment = 16;
+
+  bimap_file_layout(std::uint64_t count, std::size_t left_size, std::size_t right_size)
+      : count(count) {
+    lefts = align(sizeof(bimap_file_header));
+    rights = align(lefts + count * left_size);
+    sorted_rights = align(rights + count * right_size);
+    ranks = align(sorted_rights + count * right_size);
+    size = ranks + count * sizeof(std::uint32_t);
+  }
+
+  static bimap_file_header header(std::uint64_t count, std::size_t left_size, std::size_t right_size) {
+    bimap_file_header res{};
+    std::memcpy(res.magic, magic, sizeof(magic));
+    res.version = version;
+    res.byte_order = byte_order;
+    res.left_size = static_cast<std::uint32_t>(left_size);
+    res.right_size = static_cast<std::uint32_t>(right_size);
+    res.count = count;
+    return res;
+  }
+
+  /**
+   * throws std::runtime_error if the header was not written for pairs of
+   * these sizes on a machine like this one
+   */
+  static void check(bimap_file_header const &header, std::size_t left_size, std::size_t right_size,
+                    char const *who) {
+    if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != version) {
+      throw std::runtime_error(std::string(who) + " - not a bimap file");
+    }
+    if (header.byte_order != byte_order || header.left_size != left_size ||
+        header.right_size != right_size) {
+      throw std::runtime_error(std::string(who) + " - saved for other types or byte order");
+    }
+    if (header.count > UINT32_MAX) {
+      throw std::runtime_error(std::string(who) + " - too many pairs");
+    }
+  }
+
+  static std::size_t align(std::size_t offset) {
+    return (offset + alignment - 1) / alignment * alignment;
+  }
+
+  std::uint64_t count;
+  std::size_t lefts;
+  std::size_t rights;
+  std::size_t sorted_rights;
+  std::size_t ranks;
+  std::size_t size;
+};
@@ -0,0 +1,444 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include <stdexcept>
+#include <vector>
+#include "node.h"
+
+/**
+ * Bimap for small keys: pairs live in one vector and link to each other with
+ * 32-bit indices, 16 bytes of links per pair instead of 48 of pointers
+ * (plus a separate heap block) in bimap. There are no parent links, both
+ * trees are splayed top-down, iterators find neighbours through the root.
+ * Erase moves the last pair into the freed slot, so the vector stays dense.
+ */
+template <typename Left, typename Right,
+    typename CompareLeft = std::less<Left>, typename CompareRight = std::less<Right>>
+struct compact_bimap {
+  using left_t = Left;
+  using right_t = Right;
+
+private:
+  static constexpr std::uint32_t nil = UINT32_MAX;
+
+  struct slot {
+    template <typename L, typename R>
+    slot(L &&left, R &&right) : left(std::forward<L>(left)), right(std::forward<R>(right)) {}
+
+    left_t left;
+    right_t right;
+    // left and right children in the left tree, then in the right tree
+    std::uint32_t links[4] = {nil, nil, nil, nil};
+  };
+
+  template <typename Tag>
+  using value_t = std::conditional_t<std::is_same_v<Tag, left_tag>, left_t, right_t>;
+  template <typename Tag>
+  using opposite_t = std::conditional_t<std::is_same_v<Tag, left_tag>, right_tag, left_tag>;
+
+  template <typename Tag>
+  static constexpr std::size_t side = std::is_same_v<Tag, left_tag> ? 0 : 2;
+
+  template <typename Tag>
+  std::uint32_t &child(std::uint32_t t, bool right) const {
+    return slots[t].links[side<Tag> + right];
+  }
+
+  template <typename Tag>
+  value_t<Tag> const &key(std::uint32_t t) const {
+    if constexpr (std::is_same_v<Tag, left_tag>) {
+      return slots[t].left;
+    } else {
+      return slots[t].right;
+    }
+  }
+
+  template <typename Tag>
+  std::uint32_t &get_root() const {
+    if constexpr (std::is_same_v<Tag, left_tag>) {
+      return root_left;
+    } else {
+      return root_right;
+    }
+  }
+
+  template <typename Tag, typename T>
+  bool less(T const &a, T const &b) const {
+    if constexpr (std::is_same_v<Tag, left_tag>) {
+      return compare_left(a, b);
+    } else {
+      return compare_right(a, b);
+    }
+  }
+
+  /**
+   * top-down splay of the tree with root t: the node equal to value, or the
+   * last one on its search path, becomes the root
+   * @return new root, nil for empty tree
+   */
+  template <typename Tag>
+  std::uint32_t splay(std::uint32_t t, value_t<Tag> const &value) const {
+    if (t == nil) {
+      return nil;
+    }
+
+    // trees of nodes less and greater than value, hooks point to the
+    // free child link of their extreme node
+    std::uint32_t smaller = nil;
+    std::uint32_t bigger = nil;
+    std::uint32_t *smaller_hook = &smaller;
+    std::uint32_t *bigger_hook = &bigger;
+
+    while (true) {
+      if (less<Tag>(value, key<Tag>(t))) {
+        std::uint32_t c = child<Tag>(t, false);
+        if (c == nil) {
+          break;
+        }
+        if (less<Tag>(value, key<Tag>(c))) {
+          child<Tag>(t, false) = child<Tag>(c, true);
+          child<Tag>(c, true) = t;
+          t = c;
+          if (child<Tag>(t, false) == nil) {
+            break;
+          }
+        }
+        *bigger_hook = t;
+        bigger_hook = &child<Tag>(t, false);
+        t = child<Tag>(t, false);
+      } else if (less<Tag>(key<Tag>(t), value)) {
+        std::uint32_t c = child<Tag>(t, true);
+        if (c == nil) {
+          break;
+        }
+        if (less<Tag>(key<Tag>(c), value)) {
+          child<Tag>(t, true) = child<Tag>(c, false);
+          child<Tag>(c, false) = t;
+          t = c;
+          if (child<Tag>(t, true) == nil) {
+            break;
+          }
+        }
+        *smaller_hook = t;
+        smaller_hook = &child<Tag>(t, true);
+        t = child<Tag>(t, true);
+      } else {
+        break;
+      }
+    }
+
+    *smaller_hook = child<Tag>(t, false);
+    *bigger_hook = child<Tag>(t, true);
+    child<Tag>(t, false) = smaller;
+    child<Tag>(t, true) = bigger;
+    return t;
+  }
+
+  template <typename Tag>
+  std::uint32_t splay_root(value_t<Tag> const &value) const {
+    return get_root<Tag>() = splay<Tag>(get_root<Tag>(), value);
+  }
+
+  /**
+   * @return index of node equal to value, nil if there is none
+   */
+  template <typename Tag>
+  std::uint32_t find(value_t<Tag> const &value) const {
+    std::uint32_t t = splay_root<Tag>(value);
+    if (t == nil || less<Tag>(value, key<Tag>(t)) || less<Tag>(key<Tag>(t), value)) {
+      return nil;
+    }
+    return t;
+  }
+
+  /**
+   * makes t the root, current root has to be a neighbour of its key
+   */
+  template <typename Tag>
+  void link_at_root(std::uint32_t t) {
+    std::uint32_t root = get_root<Tag>();
+    if (root != nil) {
+      bool root_is_less = less<Tag>(key<Tag>(root), key<Tag>(t));
+      child<Tag>(t, !root_is_less) = root;
+      child<Tag>(t, root_is_less) = child<Tag>(root, root_is_less);
+      child<Tag>(root, root_is_less) = nil;
+    }
+    get_root<Tag>() = t;
+  }
+
+  /**
+   * removes t from its Tag tree
+   */
+  template <typename Tag>
+  void unlink(std::uint32_t t) {
+    splay_root<Tag>(key<Tag>(t));
+
+    std::uint32_t smaller = child<Tag>(t, false);
+    if (smaller == nil) {
+      get_root<Tag>() = child<Tag>(t, true);
+    } else {
+      // every key of smaller is less than key of t, so its max comes up
+      smaller = splay<Tag>(smaller, key<Tag>(t));
+      child<Tag>(smaller, true) = child<Tag>(t, true);
+      get_root<Tag>() = smaller;
+    }
+  }
+
+  /**
+   * removes pair t, the last pair moves to its slot
+   */
+  void erase_slot(std::uint32_t t) {
+    unlink<left_tag>(t);
+    unlink<right_tag>(t);
+
+    std::uint32_t last = static_cast<std::uint32_t>(slots.size() - 1);
+    if (t != last) {
+      // nobody links to the root, so the last pair is moved from there
+      splay_root<left_tag>(slots[last].left);
+      splay_root<right_tag>(slots[last].right);
+      slots[t] = std::move(slots[last]);
+      root_left = root_right = t;
+    }
+    slots.pop_back();
+  }
+
+  template <typename Tag>
+  std::uint32_t extreme(bool max) const {
+    std::uint32_t t = get_root<Tag>();
+    if (t == nil) {
+      return nil;
+    }
+    while (child<Tag>(t, max) != nil) {
+      t = child<Tag>(t, max);
+    }
+    return splay_root<Tag>(key<Tag>(t));
+  }
+
+  /**
+   * @return neighbour of t in given direction, nil if there is none
+   */
+  template <typename Tag>
+  std::uint32_t neighbour(std::uint32_t t, bool next) const {
+    splay_root<Tag>(key<Tag>(t));
+
+    std::uint32_t res = child<Tag>(t, next);
+    if (res == nil) {
+      return nil;
+    }
+    while (child<Tag>(res, !next) != nil) {
+      res = child<Tag>(res, !next);
+    }
+    return splay_root<Tag>(key<Tag>(res));
+  }
+
+  template <typename Tag>
+  std::uint32_t bound(value_t<Tag> const &value, bool lower_bound) const {
+    std::uint32_t t = splay_root<Tag>(value);
+    if (t == nil) {
+      return nil;
+    }
+    bool fits = lower_bound ? !less<Tag>(key<Tag>(t), value) : less<Tag>(value, key<Tag>(t));
+    return fits ? t : neighbour<Tag>(t, true);
+  }
+
+  template <typename Tag>
+  struct iterator {
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = value_t<Tag>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = value_type const *;
+    using reference = value_type const &;
+
+    reference operator*() const {
+      return bmp->key<Tag>(index);
+    }
+
+    iterator &operator++() {
+      index = bmp->neighbour<Tag>(index, true);
+      return *this;
+    }
+    iterator operator++(int) {
+      iterator old = *this;
+      ++*this;
+
+      return old;
+    }
+
+    // Декремент end() переходит к максимальному элементу.
+    iterator &operator--() {
+      index = index == nil ? bmp->extreme<Tag>(true) : bmp->neighbour<Tag>(index, false);
+      return *this;
+    }
+    iterator operator--(int) {
+      iterator old = *this;
+      --*this;
+
+      return old;
+    }
+
+    auto flip() const {
+      return iterator<opposite_t<Tag>>(index, bmp);
+    }
+
+    bool operator==(iterator const &other) const {
+      return index == other.index;
+    }
+    bool operator!=(iterator const &other) const {
+      return index != other.index;
+    }
+
+    iterator(std::uint32_t index, compact_bimap const *bmp) : index(index), bmp(bmp) {}
+
+  private:
+    friend compact_bimap;
+    std::uint32_t index;
+    compact_bimap const *bmp;
+  };
+
+  template <typename L, typename R>
+  std::uint32_t insert_unique(L &&left, R &&right) {
+    std::uint32_t l = splay_root<left_tag>(left);
+    if (l != nil && !less<left_tag>(left, key<left_tag>(l)) && !less<left_tag>(key<left_tag>(l), left)) {
+      return nil;
+    }
+    std::uint32_t r = splay_root<right_tag>(right);
+    if (r != nil && !less<right_tag>(right, key<right_tag>(r)) && !less<right_tag>(key<right_tag>(r), right)) {
+      return nil;
+    }
+    if (slots.size() == nil) {
+      throw std::length_error("compact_bimap - too many pairs");
+    }
+
+    slots.emplace_back(std::forward<L>(left), std::forward<R>(right));
+    std::uint32_t t = static_cast<std::uint32_t>(slots.size() - 1);
+    link_at_root<left_tag>(t);
+    link_at_root<right_tag>(t);
+    return t;
+  }
+
+  /**
+   * Compact bimap fields
+   */
+  mutable std::vector<slot> slots;
+  mutable std::uint32_t root_left = nil;
+  mutable std::uint32_t root_right = nil;
+
+  CompareLeft compare_left;
+  CompareRight compare_right;
+
+public:
+  using left_iterator = iterator<left_tag>;
+  using right_iterator = iterator<right_tag>;
+
+  // Создает compact_bimap не содержащий ни одной пары.
+  explicit compact_bimap(CompareLeft compare_left = CompareLeft(),
+                         CompareRight compare_right = CompareRight())
+      : compare_left(std::move(compare_left)), compare_right(std::move(compare_right)) {}
+
+  // Резервирует место под size пар, вставки до этого размера не
+  // перераспределяют память.
+  void reserve(std::size_t size) {
+    slots.reserve(size);
+  }
+
+  // Вставка пары (left, right), возвращает итератор на left.
+  // Если такой left или такой right уже присутствуют, вставка не
+  // производится и возвращается end_left().
+  left_iterator insert(left_t const &left, right_t const &right) {
+    return left_iterator(insert_unique(left, right), this);
+  }
+  left_iterator insert(left_t &&left, right_t &&right) {
+    return left_iterator(insert_unique(std::move(left), std::move(right)), this);
+  }
+
+  // Удаляет пару. В отличие от bimap, инвалидирует все итераторы:
+  // на место удаленной пары переезжает последняя.
+  void erase_left(left_iterator it) {
+    erase_slot(it.index);
+  }
+  void erase_right(right_iterator it) {
+    erase_slot(it.index);
+  }
+  // Удаляет пару по ключу, возвращает была ли пара удалена.
+  bool erase_left(left_t const &left) {
+    std::uint32_t t = find<left_tag>(left);
+    if (t == nil) {
+      return false;
+    }
+    erase_slot(t);
+    return true;
+  }
+  bool erase_right(right_t const &right) {
+    std::uint32_t t = find<right_tag>(right);
+    if (t == nil) {
+      return false;
+    }
+    erase_slot(t);
+    return true;
+  }
+
+  left_iterator find_left(left_t const &left) const {
+    return left_iterator(find<left_tag>(left), this);
+  }
+  right_iterator find_right(right_t const &right) const {
+    return right_iterator(find<right_tag>(right), this);
+  }
+
+  // Возвращает противоположный элемент по элементу
+  // Если элемента не существует -- бросает std::out_of_range
+  right_t const &at_left(left_t const &key) const {
+    std::uint32_t t = find<left_tag>(key);
+    if (t == nil) {
+      throw std::out_of_range("compact_bimap::at_left - no such element");
+    }
+    return slots[t].right;
+  }
+  left_t const &at_right(right_t const &key) const {
+    std::uint32_t t = find<right_tag>(key);
+    if (t == nil) {
+      throw std::out_of_range("compact_bimap::at_right - no such element");
+    }
+    return slots[t].left;
+  }
+
+  left_iterator lower_bound_left(left_t const &left) const {
+    return left_iterator(bound<left_tag>(left, true), this);
+  }
+  left_iterator upper_bound_left(left_t const &left) const {
+    return left_iterator(bound<left_tag>(left, false), this);
+  }
+
+  right_iterator lower_bound_right(right_t const &right) const {
+    return right_iterator(bound<right_tag>(right, true), this);
+  }
+  right_iterator upper_bound_right(right_t const &right) const {
+    return right_iterator(bound<right_tag>(right, false), this);
+  }
+
+  left_iterator begin_left() const {
+    return left_iterator(extreme<left_tag>(false), this);
+  }
+  left_iterator end_left() const {
+    return left_iterator(nil, this);
+  }
+
+  right_iterator begin_right() const {
+    return right_iterator(extreme<right_tag>(false), this);
+  }
+  right_iterator end_right() const {
+    return right_iterator(nil, this);
+  }
+
+  bool empty() const {
+    return slots.empty();
+  }
+
+  std::size_t size() const {
+    return slots.size();
+  }
+};
@@ -0,0 +1,231 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <stdexcept>
+#include <utility>
+#include "bimap.h"
+
+/**
+ * Thread safe bimap. Pairs are partitioned twice: by hash of left into
+ * left shards, which own the pairs, and by hash of right into right
+ * shards, which index the same pairs by right. Every shard is a hashed
+ * bimap under its own shared_mutex, so operations on different keys rarely
+ * contend and lookups of one side take one shared lock.
+ *
+ * Writers lock the left shard of a pair before its right shard, the same
+ * order everywhere, so both uniqueness checks and both updates happen under
+ * the two locks at once and no cycle of waiting threads can form.
+ */
+template <typename Left, typename Right,
+    typename CompareLeft = std::less<Left>, typename CompareRight = std::less<Right>,
+    typename HashLeft = std::hash<Left>, typename HashRight = std::hash<Right>>
+struct concurrent_bimap {
+  using left_t = Left;
+  using right_t = Right;
+
+private:
+  using left_map = bimap<left_t, right_t, CompareLeft, CompareRight,
+                         std::allocator<splay_tree<left_t, right_t>>, splay_policy,
+                         hash_index<HashLeft, void>>;
+  using right_map = bimap<right_t, left_t, CompareRight, CompareLeft,
+                          std::allocator<splay_tree<right_t, left_t>>, splay_policy,
+                          hash_index<HashRight, void>>;
+
+  /**
+   * a cache line each, locks of neighbouring shards don't share lines
+   */
+  template <typename Map>
+  struct alignas(64) shard {
+    mutable std::shared_mutex lock;
+    Map map;
+  };
+
+  /**
+   * shard of hash h: top bits of the Fibonacci mix, the hash tables inside
+   * the shards take their buckets from lower bits
+   */
+  std::size_t shard_of(std::size_t h) const {
+    std::uint64_t mixed = static_cast<std::uint64_t>(h) * 0x9E3779B97F4A7C15ull;
+    return shard_bits == 0 ? 0 : static_cast<std::size_t>(mixed >> (64 - shard_bits));
+  }
+
+  shard<left_map> &left_shard(left_t const &left) const {
+    return left_shards[shard_of(hash_left(left))];
+  }
+  shard<right_map> &right_shard(right_t const &right) const {
+    return right_shards[shard_of(hash_right(right))];
+  }
+
+  template <typename L, typename R>
+  bool insert_unique(L &&left, R &&right) {
+    auto &ls = left_shard(left);
+    auto &rs = right_shard(right);
+    std::unique_lock left_lock(ls.lock);
+    std::unique_lock right_lock(rs.lock);
+
+    if (ls.map.view().find_left(left) != ls.map.view().end_left() ||
+        rs.map.view().find_left(right) != rs.map.view().end_left()) {
+      return false;
+    }
+
+    rs.map.insert(right, left);
+    try {
+      ls.map.insert(std::forward<L>(left), std::forward<R>(right));
+    } catch (...) {
+      rs.map.erase_left(right);
+      throw;
+    }
+    return true;
+  }
+
+  /**
+   * Concurrent bimap fields
+   */
+  std::size_t shard_bits = 0;
+  std::unique_ptr<shard<left_map>[]> left_shards;
+  std::unique_ptr<shard<right_map>[]> right_shards;
+  HashLeft hash_left;
+  HashRight hash_right;
+
+public:
+  // Создает пустой concurrent_bimap из shards частей с каждой стороны,
+  // количество округляется вверх до степени двойки.
+  explicit concurrent_bimap(std::size_t shards = 64,
+                            HashLeft hash_left = HashLeft(),
+                            HashRight hash_right = HashRight())
+      : hash_left(std::move(hash_left)), hash_right(std::move(hash_right)) {
+    while ((std::size_t(1) << shard_bits) < shards) {
+      shard_bits++;
+    }
+    left_shards = std::make_unique<shard<left_map>[]>(std::size_t(1) << shard_bits);
+    right_shards = std::make_unique<shard<right_map>[]>(std::size_t(1) << shard_bits);
+  }
+
+  concurrent_bimap(concurrent_bimap const &) = delete;
+  concurrent_bimap &operator=(concurrent_bimap const &) = delete;
+
+  // Вставка пары (left, right), возвращает была ли она вставлена.
+  // Если такой left или такой right уже присутствуют, вставка не
+  // производится. Обе проверки и вставка атомарны.
+  bool insert(left_t const &left, right_t const &right) {
+    return insert_unique(left, right);
+  }
+  bool insert(left_t &&left, right_t &&right) {
+    return insert_unique(std::move(left), std::move(right));
+  }
+
+  // Удаляет пару по ключу, возвращает была ли пара удалена.
+  bool erase_left(left_t const &left) {
+    auto &ls = left_shard(left);
+    std::unique_lock left_lock(ls.lock);
+
+    auto it = ls.map.view().find_left(left);
+    if (it == ls.map.view().end_left()) {
+      return false;
+    }
+
+    auto &rs = right_shard(*it.flip());
+    std::unique_lock right_lock(rs.lock);
+    rs.map.erase_left(*it.flip());
+    ls.map.erase_left(left);
+    return true;
+  }
+  bool erase_right(right_t const &right) {
+    auto &rs = right_shard(right);
+
+    // the left shard is locked first, so the pair is looked up without
+    // its lock and checked again under both locks
+    while (true) {
+      std::optional<left_t> left;
+      {
+        std::shared_lock right_lock(rs.lock);
+        auto it = rs.map.view().find_left(right);
+        if (it == rs.map.view().end_left()) {
+          return false;
+        }
+        left.emplace(*it.flip());
+      }
+
+      auto &ls = left_shard(*left);
+      std::unique_lock left_lock(ls.lock);
+      std::unique_lock right_lock(rs.lock);
+
+      auto it = rs.map.view().find_left(right);
+      if (it == rs.map.view().end_left()) {
+        return false;
+      }
+      // equivalence by the comparator, right_t needs no operator== and
+      // a looser order than == still matches the pair
+      auto paired = ls.map.view().find_left(*left);
+      auto compare = ls.map.key_comp_right();
+      if (paired == ls.map.view().end_left() ||
+          compare(*paired.flip(), *it) || compare(*it, *paired.flip())) {
+        // paired with another left meanwhile
+        continue;
+      }
+
+      ls.map.erase_left(*left);
+      rs.map.erase_left(right);
+      return true;
+    }
+  }
+
+  // Возвращает копию противоположного элемента, ссылку нельзя вернуть:
+  // пару могут удалить сразу после снятия блокировки.
+  // Если элемента не существует -- бросает std::out_of_range
+  right_t at_left(left_t const &key) const {
+    if (auto res = find_left(key)) {
+      return std::move(*res);
+    }
+    throw std::out_of_range("concurrent_bimap::at_left - no such element");
+  }
+  left_t at_right(right_t const &key) const {
+    if (auto res = find_right(key)) {
+      return std::move(*res);
+    }
+    throw std::out_of_range("concurrent_bimap::at_right - no such element");
+  }
+
+  // Поиск без исключений: противоположный элемент или nullopt
+  std::optional<right_t> find_left(left_t const &key) const {
+    auto &ls = left_shard(key);
+    std::shared_lock lock(ls.lock);
+
+    auto it = ls.map.view().find_left(key);
+    if (it == ls.map.view().end_left()) {
+      return std::nullopt;
+    }
+    return *it.flip();
+  }
+  std::optional<left_t> find_right(right_t const &key) const {
+    auto &rs = right_shard(key);
+    std::shared_lock lock(rs.lock);
+
+    auto it = rs.map.view().find_left(key);
+    if (it == rs.map.view().end_left()) {
+      return std::nullopt;
+    }
+    return *it.flip();
+  }
+
+  // Количество пар. При одновременных изменениях -- значение на какой-то
+  // момент обхода частей, а не на момент вызова.
+  std::size_t size() const {
+    std::size_t res = 0;
+    for (std::size_t i = 0; i < (std::size_t(1) << shard_bits); i++) {
+      std::shared_lock lock(left_shards[i].lock);
+      res += left_shards[i].map.size();
+    }
+    return res;
+  }
+
+  bool empty() const {
+    return size() == 0;
+  }
+};
@@ -0,0 +1,331 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include <stdexcept>
+#include <numeric>
+#include <vector>
+#include <algorithm>
+#include "bimap.h"
+
+/**
+ * Read only bimap for lookup heavy workloads. Pairs live in one array of
+ * slots sorted by left, each side has an Eytzinger laid out array of its keys
+ * with 32-bit handles to the slots: a search touches consecutive levels of
+ * the implicit tree, which share cache lines near the top and are
+ * prefetched below, instead of one random node per level.
+ */
+template <typename Left, typename Right,
+    typename CompareLeft = std::less<Left>, typename CompareRight = std::less<Right>>
+struct frozen_bimap {
+  using left_t = Left;
+  using right_t = Right;
+
+private:
+  using slot_t = std::pair<left_t, right_t>;
+
+  /**
+   * keys in breadth first order of the implicit search tree, node k
+   * (1-based) has children 2k and 2k + 1; ranks[k - 1] is the position of
+   * keys[k - 1] in sorted order
+   */
+  template <typename T>
+  struct eytzinger_index {
+    std::vector<T> keys;
+    std::vector<std::uint32_t> ranks;
+
+    /**
+     * @param sorted key of the rank-th element
+     */
+    template <typename Sorted>
+    void build(std::size_t size, Sorted sorted) {
+      ranks.resize(size);
+      std::uint32_t next_rank = 0;
+      fill(1, next_rank);
+
+      keys.reserve(size);
+      for (std::uint32_t rank : ranks) {
+        keys.push_back(sorted(rank));
+      }
+    }
+
+    /**
+     * @return position (1-based) of the first key for which go_right is
+     * false, 0 if there is none
+     */
+    template <typename GoRight>
+    std::size_t search(GoRight go_right) const {
+      // descendants of k four levels down are 16k, ..., 16k + 15: one cache
+      // line for 4-byte keys, fetched while the next levels are compared
+      constexpr std::size_t ahead = 16;
+      std::size_t const size = keys.size();
+      std::size_t k = 1;
+
+      while (k <= size) {
+#if defined(__GNUC__)
+        if (ahead * k <= size) {
+          __builtin_prefetch(keys.data() + ahead * k - 1);
+        }
+#endif
+        k = 2 * k + (go_right(keys[k - 1]) ? 1 : 0);
+      }
+
+      // last left turn: drop the trailing right turns and the left one
+      while (k & 1) {
+        k >>= 1;
+      }
+      return k >> 1;
+    }
+
+  private:
+    /**
+     * in-order walk of the implicit tree, depth is log n
+     */
+    void fill(std::size_t k, std::uint32_t &next_rank) {
+      if (k > ranks.size()) {
+        return;
+      }
+      fill(2 * k, next_rank);
+      ranks[k - 1] = next_rank++;
+      fill(2 * k + 1, next_rank);
+    }
+  };
+
+  template <typename Tag>
+  struct iterator {
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = std::conditional_t<std::is_same_v<Tag, left_tag>, left_t, right_t>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = value_type const *;
+    using reference = value_type const &;
+
+    reference operator*() const {
+      if constexpr (std::is_same_v<Tag, left_tag>) {
+        return bmp->slots[rank].first;
+      } else {
+        return bmp->slots[bmp->right_slots[rank]].second;
+      }
+    }
+
+    iterator &operator++() {
+      rank++;
+      return *this;
+    }
+    iterator operator++(int) {
+      iterator old = *this;
+      ++*this;
+
+      return old;
+    }
+
+    iterator &operator--() {
+      rank--;
+      return *this;
+    }
+    iterator operator--(int) {
+      iterator old = *this;
+      --*this;
+
+      return old;
+    }
+
+    auto flip() const {
+      if constexpr (std::is_same_v<Tag, left_tag>) {
+        std::size_t res = rank == bmp->size() ? rank : bmp->right_ranks[rank];
+        return iterator<right_tag>(res, bmp);
+      } else {
+        std::size_t res = rank == bmp->size() ? rank : bmp->right_slots[rank];
+        return iterator<left_tag>(res, bmp);
+      }
+    }
+
+    bool operator==(iterator const &other) const {
+      return rank == other.rank;
+    }
+    bool operator!=(iterator const &other) const {
+      return rank != other.rank;
+    }
+
+    iterator(std::size_t rank, frozen_bimap const *bmp) : rank(rank), bmp(bmp) {}
+
+  private:
+    friend frozen_bimap;
+    std::size_t rank;
+    frozen_bimap const *bmp;
+  };
+
+  template <typename Tag>
+  std::size_t rank_of(std::size_t k) const {
+    if (k == 0) {
+      return size();
+    }
+    if constexpr (std::is_same_v<Tag, left_tag>) {
+      return index_left.ranks[k - 1];
+    } else {
+      return index_right.ranks[k - 1];
+    }
+  }
+
+  template <typename Tag, typename T>
+  std::size_t search(T const &value, bool lower_bound) const {
+    auto const &index = get_index<Tag>();
+    auto const &compare = get_compare<Tag>();
+
+    if (lower_bound) {
+      return index.search([&](T const &key) { return compare(key, value); });
+    } else {
+      return index.search([&](T const &key) { return !compare(value, key); });
+    }
+  }
+
+  template <typename Tag, typename T>
+  std::size_t find(T const &value) const {
+    std::size_t k = search<Tag>(value, true);
+    if (k != 0 && get_compare<Tag>()(value, get_index<Tag>().keys[k - 1])) {
+      return 0;
+    }
+    return k;
+  }
+
+  template <typename Tag>
+  auto const &get_index() const {
+    if constexpr (std::is_same_v<Tag, left_tag>) {
+      return index_left;
+    } else {
+      return index_right;
+    }
+  }
+
+  template <typename Tag>
+  auto const &get_compare() const {
+    if constexpr (std::is_same_v<Tag, left_tag>) {
+      return compare_left;
+    } else {
+      return compare_right;
+    }
+  }
+
+  /**
+   * builds both indices from slots, already sorted by left
+   */
+  void build() {
+    if (slots.size() > UINT32_MAX) {
+      throw std::length_error("frozen_bimap - too many pairs");
+    }
+
+    right_slots.resize(slots.size());
+    std::iota(right_slots.begin(), right_slots.end(), 0);
+    std::sort(right_slots.begin(), right_slots.end(), [this](std::uint32_t a, std::uint32_t b) {
+      return compare_right(slots[a].second, slots[b].second);
+    });
+    right_ranks.resize(slots.size());
+    for (std::size_t i = 0; i < right_slots.size(); i++) {
+      right_ranks[right_slots[i]] = static_cast<std::uint32_t>(i);
+    }
+
+    index_left.build(slots.size(), [this](std::uint32_t rank) { return slots[rank].first; });
+    index_right.build(slots.size(), [this](std::uint32_t rank) {
+      return slots[right_slots[rank]].second;
+    });
+  }
+
+  /**
+   * Frozen bimap fields
+   */
+  std::vector<slot_t> slots;
+  // slots by rank of right and back
+  std::vector<std::uint32_t> right_slots;
+  std::vector<std::uint32_t> right_ranks;
+  eytzinger_index<left_t> index_left;
+  eytzinger_index<right_t> index_right;
+  CompareLeft compare_left;
+  CompareRight compare_right;
+
+public:
+  using left_iterator = iterator<left_tag>;
+  using right_iterator = iterator<right_tag>;
+
+  // Создает пустой frozen_bimap
+  explicit frozen_bimap(CompareLeft compare_left = CompareLeft(),
+                        CompareRight compare_right = CompareRight())
+      : compare_left(std::move(compare_left)), compare_right(std::move(compare_right)) {}
+
+  // Копирует все пары и компараторы bimap, сам bimap при этом не
+  // перестраивается. Изменения bimap после создания не видны.
+  template <typename Allocator, typename TreePolicy, typename HashIndex, typename Stats>
+  explicit frozen_bimap(bimap<left_t, right_t, CompareLeft, CompareRight, Allocator, TreePolicy, HashIndex, Stats> const &other)
+      : compare_left(other.key_comp_left()), compare_right(other.key_comp_right()) {
+    auto view = other.view();
+    slots.reserve(view.size());
+    for (auto it = view.begin_left(); it != view.end_left(); ++it) {
+      slots.emplace_back(*it, *it.flip());
+    }
+    build();
+  }
+
+  // Поиск элемента, возвращает итератор на него или end, если не нашел
+  left_iterator find_left(left_t const &left) const {
+    return left_iterator(rank_of<left_tag>(find<left_tag>(left)), this);
+  }
+  right_iterator find_right(right_t const &right) const {
+    return right_iterator(rank_of<right_tag>(find<right_tag>(right)), this);
+  }
+
+  // Возвращает противоположный элемент по элементу
+  // Если элемента не существует -- бросает std::out_of_range
+  right_t const &at_left(left_t const &key) const {
+    std::size_t k = find<left_tag>(key);
+    if (k == 0) {
+      throw std::out_of_range("frozen_bimap::at_left - no such element");
+    }
+    return slots[index_left.ranks[k - 1]].second;
+  }
+  left_t const &at_right(right_t const &key) const {
+    std::size_t k = find<right_tag>(key);
+    if (k == 0) {
+      throw std::out_of_range("frozen_bimap::at_right - no such element");
+    }
+    return slots[right_slots[index_right.ranks[k - 1]]].first;
+  }
+
+  // lower и upper bound'ы по каждой стороне
+  left_iterator lower_bound_left(left_t const &left) const {
+    return left_iterator(rank_of<left_tag>(search<left_tag>(left, true)), this);
+  }
+  left_iterator upper_bound_left(left_t const &left) const {
+    return left_iterator(rank_of<left_tag>(search<left_tag>(left, false)), this);
+  }
+
+  right_iterator lower_bound_right(right_t const &right) const {
+    return right_iterator(rank_of<right_tag>(search<right_tag>(right, true)), this);
+  }
+  right_iterator upper_bound_right(right_t const &right) const {
+    return right_iterator(rank_of<right_tag>(search<right_tag>(right, false)), this);
+  }
+
+  left_iterator begin_left() const {
+    return left_iterator(0, this);
+  }
+  left_iterator end_left() const {
+    return left_iterator(size(), this);
+  }
+
+  right_iterator begin_right() const {
+    return right_iterator(0, this);
+  }
+  right_iterator end_right() const {
+    return right_iterator(size(), this);
+  }
+
+  bool empty() const {
+    return slots.empty();
+  }
+
+  std::size_t size() const {
+    return slots.size();
+  }
+};
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+/**
+ * Hash index policy of bimap: HashLeft and HashRight hash keys of their
+ * side, void leaves the side with its tree only. Equality of keys is taken
+ * from the side's comparator, so the hash has to agree with it.
+ */
+template <typename HashLeft = void, typename HashRight = void>
+struct hash_index {
+  using left_hash = HashLeft;
+  using right_hash = HashRight;
+};
+
+/**
+ * stands in for the table of a side without hash index
+ */
+struct no_hash_table {
+  template <typename Allocator>
+  explicit no_hash_table(Allocator const &) {}
+};
+
+/**
+ * Open addressing table of tree nodes, keyed by node->value. Linear probing
+ * with backward shift deletion, so there are no tombstones and erase keeps
+ * probe sequences short. The table only indexes nodes, it never owns them.
+ */
+template <typename N, typename Hash, typename Allocator>
+struct node_hash_table {
+  template <typename OtherAllocator>
+  explicit node_hash_table(OtherAllocator const &allocator) : slots(slot_allocator(allocator)) {}
+
+  node_hash_table(node_hash_table &&other) noexcept
+      : hash(std::move(other.hash)), slots(std::move(other.slots)), count(other.count) {
+    other.slots.clear();
+    other.count = 0;
+  }
+
+  node_hash_table(node_hash_table const &) = delete;
+  node_hash_table &operator=(node_hash_table const &) = delete;
+
+  /**
+   * @return node with value equal to given one, nullptr if there is none
+   */
+  template <typename T, typename Equal>
+  N *find(T const &value, Equal equal) const {
+    if (slots.empty()) {
+      return nullptr;
+    }
+
+    std::size_t mask = slots.size() - 1;
+    for (std::size_t i = bucket(value); slots[i]; i = (i + 1) & mask) {
+      if (equal(slots[i]->value, value)) {
+        return slots[i];
+      }
+    }
+    return nullptr;
+  }
+
+  /**
+   * makes room for size nodes, the only operation which allocates
+   */
+  void reserve(std::size_t size) {
+    if (size * 4 <= slots.size() * 3) {
+      return;
+    }
+
+    std::size_t capacity = 8;
+    while (size * 4 > capacity * 3) {
+      capacity *= 2;
+    }
+
+    std::vector<N *, slot_allocator> old(capacity, nullptr, slots.get_allocator());
+    old.swap(slots);
+    for (N *t : old) {
+      if (t) {
+        place(t);
+      }
+    }
+  }
+
+  /**
+   * adds t, which is not in the table yet, room has to be reserved
+   */
+  void insert(N *t) noexcept {
+    place(t);
+    count++;
+  }
+
+  void erase(N *t) noexcept {
+    std::size_t mask = slots.size() - 1;
+    std::size_t i = bucket(t->value);
+    while (slots[i] != t) {
+      i = (i + 1) & mask;
+    }
+
+    // shift back every following node whose probe sequence passes i
+    for (std::size_t j = (i + 1) & mask; slots[j]; j = (j + 1) & mask) {
+      std::size_t home = bucket(slots[j]->value);
+      bool reachable = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+      if (!reachable) {
+        slots[i] = slots[j];
+        i = j;
+      }
+    }
+    slots[i] = nullptr;
+    count--;
+  }
+
+  void clear() noexcept {
+    std::fill(slots.begin(), slots.end(), nullptr);
+    count = 0;
+  }
+
+  std::size_t size() const {
+    return count;
+  }
+
+  void swap(node_hash_table &other) noexcept {
+    using std::swap;
+
+    swap(hash, other.hash);
+    slots.swap(other.slots);
+    swap(count, other.count);
+  }
+
+private:
+  using slot_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<N *>;
+
+  template <typename T>
+  std::size_t bucket(T const &value) const {
+    // Fibonacci hashing, identity hashes of integers would cluster otherwise
+    std::uint64_t h = static_cast<std::uint64_t>(hash(value)) * 0x9E3779B97F4A7C15ull;
+    return static_cast<std::size_t>(h >> 32) & (slots.size() - 1);
+  }
+
+  void place(N *t) noexcept {
+    std::size_t mask = slots.size() - 1;
+    std::size_t i = bucket(t->value);
+    while (slots[i]) {
+      i = (i + 1) & mask;
+    }
+    slots[i] = t;
+  }
+
+  Hash hash;
+  std::vector<N *, slot_allocator> slots;
+  std::size_t count = 0;
+};
@@ -1,7 +1,21 @@
 #include "bimap.h"
+#include "frozen_bimap.h"
+#include "mapped_bimap.h"
+#include "compact_bimap.h"
+#include "concurrent_bimap.h"
+#include "persistent_bimap.h"
+#include "pool_allocator.h"
 
 #include "gtest/gtest.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstring>
+#include <fstream>
 #include <random>
+#include <sstream>
+#include <string_view>
+#include <thread>
 
 struct test_object {
   int a = 0;
@@ -103,6 +117,56 @@ TEST(bimap, copies) {
   EXPECT_NE(b.find_right(-10), b.end_right());
 }
 
+TEST(bimap, copy_preserves_both_orders) {
+  bimap<int, int> b;
+  std::mt19937 e(42);
+  for (int i = 0; i < 1000; i++) {
+    b.insert(e() % 5000, e() % 5000);
+  }
+
+  bimap<int, int> const &cb = b;
+  bimap<int, int> b1(cb);
+  EXPECT_EQ(b1.size(), b.size());
+  EXPECT_EQ(b1, b);
+  for (auto it = b.begin_right(); it != b.end_right(); it++) {
+    EXPECT_EQ(b1.at_right(*it), *it.flip());
+  }
+
+  b1.erase_left(b1.begin_left());
+  EXPECT_NE(b1, b);
+  bimap<int, int> empty;
+  bimap<int, int> empty_copy(empty);
+  EXPECT_TRUE(empty_copy.empty());
+}
+
+TEST(bimap, from_sorted) {
+  using int_bimap = bimap<int, int>;
+  std::vector<std::pair<int, int>> data;
+  for (int i = 0; i < 1000; i++) {
+    data.emplace_back(i * 2, (i * 7919) % 1000);
+  }
+
+  auto b = int_bimap::from_sorted(data);
+  EXPECT_EQ(b.size(), 1000);
+  for (auto const &p : data) {
+    EXPECT_EQ(b.at_left(p.first), p.second);
+    EXPECT_EQ(b.at_right(p.second), p.first);
+  }
+  EXPECT_EQ(*b.lower_bound_left(51), 52);
+  EXPECT_EQ(*b.begin_right(), 0);
+  EXPECT_TRUE(b.insert(1, 1000) != b.end_left());
+
+  std::vector<std::pair<std::string, int>> words = {{"a", 3}, {"b", 1}, {"c", 2}};
+  auto w = bimap<std::string, int>::from_sorted(
+      std::make_move_iterator(words.begin()), std::make_move_iterator(words.end()));
+  EXPECT_EQ(w.at_right(1), "b");
+
+  data.emplace_back(1, 5000);
+  EXPECT_THROW(int_bimap::from_sorted(data), std::invalid_argument);
+  data.back() = {5000, 0};
+  EXPECT_THROW(int_bimap::from_sorted(data), std::invalid_argument);
+}
+
 TEST(bimap, insert) {
   bimap<int, int> b;
   b.insert(4, 10);
@@ -188,6 +252,27 @@ TEST(bimap, insert_exist) {
   EXPECT_EQ(b.size(), 3);
 }
 
+TEST(bimap, try_insert) {
+  bimap<int, int> b;
+  auto res = b.try_insert(1, 2);
+  EXPECT_TRUE(res.second);
+  EXPECT_EQ(*res.first, 1);
+  b.insert(3, 4);
+
+  res = b.try_insert(1, 10);
+  EXPECT_FALSE(res.second);
+  EXPECT_EQ(*res.first.flip(), 2);
+
+  res = b.try_insert(10, 4);
+  EXPECT_FALSE(res.second);
+  EXPECT_EQ(*res.first, 3);
+
+  res = b.try_insert(2, 3);
+  EXPECT_TRUE(res.second);
+  EXPECT_EQ(*++res.first, 3);
+  EXPECT_EQ(b.size(), 3);
+}
+
 TEST(bimap, erase_iterator) {
   bimap<int, int> b;
   auto it = b.insert(1, 2);
@@ -238,6 +323,86 @@ TEST(bimap, erase_range) {
   EXPECT_TRUE(b.empty());
 }
 
+TEST(bimap, erase_big_range) {
+  bimap<int, int> b;
+  std::map<int, int> left_view;
+  std::mt19937 e(7);
+  for (int i = 0; i < 3000; i++) {
+    int l = e() % 10000, r = e() % 10000;
+    if (b.insert(l, r) != b.end_left()) {
+      left_view[l] = r;
+    }
+  }
+
+  // small ranges unlink partners one by one, big ones rebuild the other tree
+  for (int width : {5, 50, 2000}) {
+    int from = e() % 5000;
+    auto it = b.erase_left(b.lower_bound_left(from), b.lower_bound_left(from + width));
+    left_view.erase(left_view.lower_bound(from), left_view.lower_bound(from + width));
+    EXPECT_EQ(it, b.lower_bound_left(from + width));
+    EXPECT_EQ(b.size(), left_view.size());
+
+    auto lit = b.begin_left();
+    for (auto const &p : left_view) {
+      EXPECT_EQ(*lit, p.first);
+      EXPECT_EQ(b.at_right(p.second), p.first);
+      lit++;
+    }
+    auto v = b.view();
+    std::vector<int> rights(v.begin_right(), v.end_right());
+    EXPECT_TRUE(std::is_sorted(rights.begin(), rights.end()));
+    EXPECT_EQ(rights.size(), left_view.size());
+  }
+
+  b.erase_right(b.lower_bound_right(5000), b.end_right());
+  for (auto it = b.begin_left(); it != b.end_left(); it++) {
+    EXPECT_LT(*it.flip(), 5000);
+  }
+  b.erase_right(b.begin_right(), b.end_right());
+  EXPECT_TRUE(b.empty());
+}
+
+TEST(bimap, batch_lookup) {
+  bimap<int, int> b;
+  std::mt19937 e(1);
+  for (int i = 0; i < 1000; i++) {
+    b.insert(i * 2, i * 3);
+  }
+
+  std::vector<int> keys;
+  for (int i = 0; i < 300; i++) {
+    keys.push_back(e() % 1000 * 2);
+  }
+  std::vector<int> rights;
+  b.at_left_batch(keys.begin(), keys.end(), std::back_inserter(rights));
+  ASSERT_EQ(rights.size(), keys.size());
+  for (size_t i = 0; i < keys.size(); i++) {
+    EXPECT_EQ(rights[i], keys[i] / 2 * 3);
+  }
+
+  std::vector<int> lefts;
+  b.at_right_batch(rights.begin(), rights.end(), std::back_inserter(lefts));
+  EXPECT_EQ(lefts, keys);
+
+  keys.push_back(1);
+  rights.clear();
+  EXPECT_THROW(b.at_left_batch(keys.begin(), keys.end(), std::back_inserter(rights)),
+               std::out_of_range);
+  EXPECT_TRUE(rights.empty());
+
+  std::vector<int> probes = {5, 4, -1, 1998, 2000, 4, 0};
+  std::vector<bimap<int, int>::left_iterator> found;
+  b.find_left_batch(probes.begin(), probes.end(), std::back_inserter(found));
+  ASSERT_EQ(found.size(), probes.size());
+  for (size_t i = 0; i < probes.size(); i++) {
+    EXPECT_EQ(found[i], b.find_left(probes[i]));
+  }
+  std::vector<bimap<int, int>::right_iterator> found_right;
+  b.find_right_batch(probes.begin(), probes.end(), std::back_inserter(found_right));
+  EXPECT_EQ(found_right[3], b.find_right(1998));
+  EXPECT_EQ(found_right[0], b.end_right());
+}
+
 TEST(bimap, lower_bound) {
   bimap<int, int> b;
 
@@ -273,6 +438,117 @@ TEST(bimap, upper_bound) {
   EXPECT_EQ(b.upper_bound_left(400), b.end_left());
 }
 
+TEST(bimap, equality_concurrent) {
+  bimap<int, int> b1, b2, b3;
+  for (int i = 0; i < 5000; i++) {
+    b1.insert(i, -i);
+    b2.insert(4999 - i, i - 4999);
+    b3.insert(i, i == 2500 ? 1 : -i);
+  }
+
+  // comparison only reads the trees, so it may run on many threads at once
+  std::vector<std::thread> readers;
+  std::vector<int> errors(4);
+  for (int t = 0; t < 4; t++) {
+    readers.emplace_back([&, t] {
+      for (int i = 0; i < 20; i++) {
+        errors[t] += !(b1 == b2) + !(b2 != b3) + !(b3 == b3);
+      }
+    });
+  }
+  for (auto &r : readers) {
+    r.join();
+  }
+
+  EXPECT_EQ(errors, std::vector<int>(4));
+}
+
+TEST(bimap, scan) {
+  bimap<int, int> b;
+  for (int i = 0; i < 1000; i++) {
+    b.insert(i * 7 % 1000, -i);
+  }
+
+  int expected = 0;
+  for (int left : b.scan_left()) {
+    EXPECT_EQ(left, expected++);
+  }
+  EXPECT_EQ(expected, 1000);
+
+  auto rights = b.scan_right();
+  EXPECT_EQ(*rights.begin(), -999);
+  EXPECT_EQ(*--rights.end(), 0);
+  EXPECT_TRUE(std::is_sorted(rights.begin(), rights.end()));
+  EXPECT_EQ(std::distance(rights.begin(), rights.end()), 1000);
+  for (auto it = rights.begin(); it != rights.end(); ++it) {
+    EXPECT_EQ(b.at_right(*it), *it.flip());
+  }
+
+  bimap<int, int> empty;
+  EXPECT_EQ(empty.scan_left().begin(), empty.scan_left().end());
+}
+
+TEST(bimap, const_view) {
+  bimap<int, int> b;
+  b.insert(1, 2);
+  b.insert(2, 3);
+  b.insert(3, 4);
+  b.insert(8, 16);
+  b.insert(32, 66);
+
+  auto v = b.view();
+  EXPECT_EQ(v.size(), 5);
+  EXPECT_EQ(v.at_left(8), 16);
+  EXPECT_EQ(v.at_right(66), 32);
+  EXPECT_THROW(v.at_left(5), std::out_of_range);
+  EXPECT_EQ(*v.find_right(3).flip(), 2);
+  EXPECT_EQ(v.find_left(7), v.end_left());
+  EXPECT_EQ(*v.lower_bound_left(5), 8);
+  EXPECT_EQ(*v.upper_bound_left(8), 32);
+  EXPECT_EQ(*v.lower_bound_right(4), 4);
+  EXPECT_EQ(v.upper_bound_right(66), v.end_right());
+  EXPECT_EQ(*--v.end_left(), 32);
+
+  std::vector<int> lefts(v.begin_left(), v.end_left());
+  EXPECT_EQ(lefts, std::vector<int>({1, 2, 3, 8, 32}));
+  std::vector<int> rights;
+  for (auto it = v.end_right(); it != v.begin_right();) {
+    rights.push_back(*--it);
+  }
+  EXPECT_EQ(rights, std::vector<int>({66, 16, 4, 3, 2}));
+}
+
+TEST(bimap, const_view_concurrent_reads) {
+  bimap<int, int> b;
+  for (int i = 0; i < 10000; i++) {
+    b.insert(i, -i);
+  }
+
+  auto v = b.view();
+  std::vector<std::thread> readers;
+  std::vector<int> errors(4);
+  for (int t = 0; t < 4; t++) {
+    readers.emplace_back([&v, &errors, t] {
+      std::mt19937 e(t);
+      for (int i = 0; i < 20000; i++) {
+        int key = e() % 10000;
+        if (v.at_left(key) != -key || *v.find_right(-key).flip() != key) {
+          errors[t]++;
+        }
+      }
+      int expected = 0;
+      for (auto it = v.begin_left(); it != v.end_left(); ++it) {
+        errors[t] += *it != expected++;
+      }
+    });
+  }
+  for (auto &r : readers) {
+    r.join();
+  }
+
+  EXPECT_EQ(errors, std::vector<int>(4));
+}
+
 template <typename T>
 std::vector<std::pair<T, T>>
 eliminate_same(std::vector<T> &lefts, std::vector<T> &rights, std::mt19937 &e) {
@@ -316,6 +592,1390 @@ template struct bimap<non_default_constructible, int>;
 
 static constexpr uint32_t seed = 1488228;
 
+template <typename T>
+struct counting_allocator {
+  using value_type = T;
+
+  explicit counting_allocator(int *live) : live(live) {}
+  template <typename U>
+  counting_allocator(counting_allocator<U> const &other) : live(other.live) {}
+
+  T *allocate(size_t n) {
+    *live += n;
+    return std::allocator<T>().allocate(n);
+  }
+  void deallocate(T *p, size_t n) {
+    *live -= n;
+    std::allocator<T>().deallocate(p, n);
+  }
+
+  template <typename U>
+  bool operator==(counting_allocator<U> const &other) const {
+    return live == other.live;
+  }
+  template <typename U>
+  bool operator!=(counting_allocator<U> const &other) const {
+    return live != other.live;
+  }
+
+  int *live;
+};
+
+TEST(bimap, custom_allocator) {
+  int live = 0;
+  {
+    using alloc = counting_allocator<splay_tree<int, int>>;
+    bimap<int, int, std::less<int>, std::less<int>, alloc> b({}, {},
+                                                              alloc(&live));
+    for (int i = 0; i < 100; i++) {
+      b.insert(i, 100 - i);
+    }
+    b.insert(5, 1000);
+    EXPECT_EQ(live, 100);
+
+    b.erase_left(b.find_left(10), b.find_left(20));
+    EXPECT_EQ(live, 90);
+
+    auto b1 = b;
+    EXPECT_EQ(live, 180);
+    EXPECT_EQ(b1, b);
+  }
+  EXPECT_EQ(live, 0);
+}
+
+TEST(bimap, extract_insert_node) {
+  int live = 0;
+  using alloc = counting_allocator<splay_tree<int, int>>;
+  using counted_bimap = bimap<int, int, std::less<int>, std::less<int>, alloc>;
+  counted_bimap a({}, {}, alloc(&live));
+  counted_bimap b({}, {}, alloc(&live));
+  for (int i = 0; i < 10; i++) {
+    a.insert(i, 100 + i);
+  }
+  b.insert(50, 105);
+  EXPECT_EQ(live, 11);
+
+  auto nh = a.extract_left(3);
+  EXPECT_FALSE(nh.empty());
+  EXPECT_EQ(nh.left(), 3);
+  EXPECT_EQ(nh.right(), 103);
+  EXPECT_EQ(a.size(), 9);
+  EXPECT_EQ(a.find_right(103), a.end_right());
+  EXPECT_TRUE(a.extract_left(3).empty());
+
+  auto res = b.insert(std::move(nh));
+  EXPECT_TRUE(res.inserted);
+  EXPECT_TRUE(res.node.empty());
+  EXPECT_EQ(*res.position, 3);
+  EXPECT_EQ(b.at_right(103), 3);
+
+  // right 105 is taken in b, the pair comes back in the handle
+  res = b.insert(a.extract_right(105));
+  EXPECT_FALSE(res.inserted);
+  EXPECT_EQ(*res.position, 50);
+  EXPECT_EQ(res.node.left(), 5);
+  res.node.right() = 205;
+  EXPECT_TRUE(b.insert(std::move(res.node)).inserted);
+  EXPECT_EQ(b.at_left(5), 205);
+  EXPECT_EQ(live, 11);
+
+  b.insert(9, 1000);
+  a.merge(b);
+  EXPECT_EQ(b.size(), 1);
+  EXPECT_EQ(b.at_left(9), 1000);
+  EXPECT_EQ(a.size(), 11);
+  EXPECT_EQ(a.at_left(5), 205);
+  EXPECT_EQ(a.at_right(105), 50);
+  EXPECT_EQ(live, 12);
+
+  a.extract_left(a.begin_left());
+  EXPECT_EQ(live, 11);
+  EXPECT_EQ(*a.begin_left(), 1);
+}
+
+struct immovable {
+  explicit immovable(int a, int b) : value(a * 10 + b) {}
+  immovable(immovable const &) = delete;
+  immovable(immovable &&) = delete;
+  friend bool operator<(immovable const &a, immovable const &b) {
+    return a.value < b.value;
+  }
+  int value;
+};
+
+TEST(bimap, emplace) {
+  bimap<immovable, int> b;
+  auto res = b.emplace(std::piecewise_construct, std::forward_as_tuple(1, 2),
+                       std::forward_as_tuple(5));
+  EXPECT_TRUE(res.second);
+  EXPECT_EQ((*res.first).value, 12);
+  EXPECT_EQ(*res.first.flip(), 5);
+
+  res = b.emplace(std::piecewise_construct, std::forward_as_tuple(1, 2),
+                  std::forward_as_tuple(6));
+  EXPECT_FALSE(res.second);
+  EXPECT_EQ(*res.first.flip(), 5);
+  res = b.emplace(std::piecewise_construct, std::forward_as_tuple(3, 4),
+                  std::forward_as_tuple(5));
+  EXPECT_FALSE(res.second);
+  EXPECT_EQ(b.size(), 1);
+  EXPECT_EQ(b.at_right(5).value, 12);
+}
+
+TEST(bimap, try_emplace) {
+  int live = 0;
+  using alloc = counting_allocator<splay_tree<std::string, int>>;
+  bimap<std::string, int, std::less<>, std::less<int>, alloc> b({}, {}, alloc(&live));
+
+  EXPECT_TRUE(b.try_emplace("apple", 1).second);
+  EXPECT_TRUE(b.try_emplace(std::string_view("banana"), 2).second);
+  EXPECT_EQ(live, 2);
+
+  auto res = b.try_emplace("apple", 3);
+  EXPECT_FALSE(res.second);
+  EXPECT_EQ(*res.first, "apple");
+  EXPECT_FALSE(b.try_emplace(std::string_view("cherry"), 2).second);
+  // duplicates are rejected before anything is allocated
+  EXPECT_EQ(live, 2);
+  EXPECT_EQ(b.at_left("banana"), 2);
+
+  bimap<std::string, int> plain;
+  EXPECT_TRUE(plain.try_emplace("apple", 1).second);
+  EXPECT_FALSE(plain.try_emplace("apple", 2).second);
+  EXPECT_EQ(plain.size(), 1);
+}
+
+TEST(bimap, pool_allocator) {
+  using pool_bimap = bimap<int, int, std::less<int>, std::less<int>,
+                           pool_allocator<splay_tree<int, int>>>;
+  pool_bimap b;
+  std::map<int, int> expected;
+
+  std::mt19937 e(seed);
+  for (size_t i = 0; i < 20000; i++) {
+    int l = e() % 1000, r = e() % 1000;
+    if (e() % 3 == 0) {
+      EXPECT_EQ(b.erase_left(l), expected.erase(l) == 1);
+      continue;
+    }
+    bool free = expected.count(l) == 0 &&
+                std::none_of(expected.begin(), expected.end(),
+                             [r](auto const &p) { return p.second == r; });
+    EXPECT_EQ(b.insert(l, r) != b.end_left(), free);
+    if (free) {
+      expected[l] = r;
+    }
+  }
+
+  EXPECT_EQ(b.size(), expected.size());
+  auto it = b.begin_left();
+  for (auto const &p : expected) {
+    EXPECT_EQ(*it, p.first);
+    EXPECT_EQ(*it.flip(), p.second);
+    it++;
+  }
+
+  // freed nodes are reused
+  b.erase_left(b.begin_left(), b.end_left());
+  int const *first = &*b.insert(1, 1);
+  b.erase_left(1);
+  EXPECT_EQ(&*b.insert(2, 2), first);
+
+  pool_bimap copy = b;
+  EXPECT_NE(copy.get_allocator(), b.get_allocator());
+  EXPECT_EQ(copy, b);
+
+  // moved-from bimaps keep a usable allocator
+  pool_bimap moved(std::move(b));
+  EXPECT_EQ(moved.get_allocator(), b.get_allocator());
+  EXPECT_NE(b.insert(3, 4), b.end_left());
+  EXPECT_EQ(b.at_left(3), 4);
+  copy = std::move(b);
+  EXPECT_NE(b.insert(5, 6), b.end_left());
+  EXPECT_EQ(b.at_right(6), 5);
+}
+
+TEST(bimap, pool_allocator_transfer) {
+  using pool_bimap = bimap<int, int, std::less<int>, std::less<int>,
+                           pool_allocator<splay_tree<int, int>>>;
+  pool_bimap a;
+  for (int i = 0; i < 10; i++) {
+    a.insert(i, 100 + i);
+  }
+
+  // every pool lives in its own bimap, pairs can't be relinked between them
+  {
+    pool_bimap b;
+    EXPECT_NE(a.get_allocator(), b.get_allocator());
+    for (int i = 5; i < 20; i++) {
+      b.insert(i, 200 + i);
+    }
+    a.merge(b);
+    EXPECT_EQ(a.size(), 20);
+    EXPECT_EQ(b.size(), 5);
+    EXPECT_EQ(b.at_left(5), 205);
+
+    b.erase_left(b.begin_left(), b.end_left());
+    b.insert(30, 300);
+    EXPECT_TRUE(a.insert(b.extract_left(30)).inserted);
+    EXPECT_TRUE(b.empty());
+
+    pool_bimap c;
+    for (int i = 40; i < 50; i++) {
+      c.insert(i, 400 + i);
+    }
+    a.join(std::move(c));
+    EXPECT_TRUE(c.empty());
+  }
+
+  EXPECT_EQ(a.size(), 31);
+  EXPECT_EQ(a.at_left(4), 104);
+  EXPECT_EQ(a.at_left(15), 215);
+  EXPECT_EQ(a.at_right(300), 30);
+  EXPECT_EQ(a.at_right(445), 45);
+  a.erase_left(a.begin_left(), a.end_left());
+  EXPECT_TRUE(a.empty());
+}
+
+TEST(bimap, iterator_decrement) {
+  bimap<int, int> b;
+  bimap<int, int> empty;
+  EXPECT_EQ(b.begin_left(), b.end_left());
+  EXPECT_EQ(b, empty);
+
+  b.insert(1, 30);
+  b.insert(2, 20);
+  b.insert(3, 10);
+
+  auto it = b.end_left();
+  EXPECT_EQ(*--it, 3);
+  EXPECT_EQ(*--it, 2);
+  EXPECT_EQ(*--it, 1);
+  EXPECT_EQ(it, b.begin_left());
+
+  auto rit = b.end_right();
+  EXPECT_EQ(*--rit, 30);
+  EXPECT_EQ(*rit.flip(), 1);
+}
+
+using avl_bimap = bimap<int, int, std::less<int>, std::less<int>,
+                        std::allocator<splay_tree<int, int>>, avl_policy>;
+
+TEST(bimap, avl_policy) {
+  avl_bimap b;
+  for (int i = 0; i < 1000; i++) {
+    EXPECT_NE(b.insert(i, 1000 - i), b.end_left());
+  }
+  EXPECT_EQ(b.insert(5, -1), b.end_left());
+  EXPECT_EQ(b.size(), 1000);
+  EXPECT_EQ(b.at_left(10), 990);
+  EXPECT_EQ(b.at_right(10), 990);
+  EXPECT_EQ(*b.lower_bound_left(-5), 0);
+  EXPECT_EQ(*b.upper_bound_right(999), 1000);
+  EXPECT_EQ(*--b.end_left(), 999);
+
+  auto first = b.find_left(100), last = b.find_left(110);
+  b.erase_left(first, last);
+  EXPECT_EQ(b.size(), 990);
+  EXPECT_EQ(b.find_left(105), b.end_left());
+  EXPECT_EQ(b.find_right(895), b.end_right());
+
+  b.erase_right(b.begin_right(), b.find_right(800));
+  EXPECT_EQ(b.size(), 191);
+  EXPECT_EQ(*b.begin_right(), 800);
+  EXPECT_EQ(*--b.end_left(), 200);
+
+  EXPECT_EQ(b.at_left_or_default(5000), 0);
+  EXPECT_EQ(b.at_right_or_default(0), 5000);
+  EXPECT_EQ(b.at_right_or_default(1), 0);
+  EXPECT_EQ(b.find_right(1000), b.end_right());
+
+  avl_bimap copy(b);
+  EXPECT_EQ(copy, b);
+  auto v = copy.view();
+  EXPECT_EQ(v.at_left(0), 1);
+
+  // only AVL nodes pay for the height
+  EXPECT_LT((sizeof(splay_tree<size_t, size_t>)),
+            (sizeof(splay_tree<size_t, size_t, avl_policy::node_data>)));
+}
+
+TEST(bimap_randomized, avl_compare_to_two_maps) {
+  avl_bimap b;
+  std::map<int, int> left_view, right_view;
+
+  std::mt19937 e(seed);
+  for (size_t i = 0; i < 20000; i++) {
+    unsigned int op = e() % 10;
+    if (op > 2) {
+      int l = e() % 10000, r = e() % 10000;
+      auto inserted = b.insert(l, r);
+      if (inserted != b.end_left()) {
+        EXPECT_EQ(*inserted, l);
+        EXPECT_EQ(++inserted, b.upper_bound_left(l));
+        left_view.insert({l, r});
+        right_view.insert({r, l});
+      }
+    } else if (op > 0 && !b.empty()) {
+      auto it = b.lower_bound_left(e() % 10000);
+      if (it == b.end_left()) {
+        continue;
+      }
+      EXPECT_EQ(left_view.erase(*it), 1);
+      EXPECT_EQ(right_view.erase(*it.flip()), 1);
+      b.erase_left(it);
+    } else if (!b.empty()) {
+      int from = e() % 10000, to = from + e() % 300;
+      left_view.erase(left_view.lower_bound(from), left_view.lower_bound(to));
+      right_view.clear();
+      for (auto p : left_view) {
+        right_view.insert({p.second, p.first});
+      }
+      b.erase_left(b.lower_bound_left(from), b.lower_bound_left(to));
+    }
+    if (i % 100 == 0) {
+      EXPECT_EQ(b.size(), left_view.size());
+      avl_bimap::const_view v = b.view();
+      EXPECT_TRUE(std::equal(v.begin_left(), v.end_left(), left_view.begin(),
+                             left_view.end(), [](int l, auto const &p) { return l == p.first; }));
+      EXPECT_TRUE(std::equal(v.begin_right(), v.end_right(), right_view.begin(),
+                             right_view.end(), [](int r, auto const &p) { return r == p.first; }));
+    }
+  }
+}
+
+TEST(bimap, hinted_insert_find) {
+  bimap<int, int> b;
+  auto hint = b.end_left();
+  for (int i = 0; i < 1000; i++) {
+    hint = b.insert(b.end_left(), i, -i);
+  }
+  EXPECT_EQ(*hint, 999);
+  EXPECT_EQ(b.insert(hint, 5, 5), b.end_left());
+  EXPECT_EQ(b.insert(hint, 5000, -5), b.end_left());
+
+  hint = b.find_left(500);
+  EXPECT_EQ(*b.find_left(hint, 503).flip(), -503);
+  EXPECT_EQ(*b.find_left(hint, 3).flip(), -3);
+  EXPECT_EQ(b.find_left(hint, 1500), b.end_left());
+  EXPECT_EQ(*b.find_left(b.end_left(), 998), 998);
+  EXPECT_EQ(*b.find_right(b.find_right(-10), -12).flip(), 12);
+
+  auto it = b.insert(b.find_right(-999), 2000, -2000);
+  EXPECT_EQ(*it, 2000);
+  EXPECT_EQ(*b.begin_right(), -2000);
+
+  avl_bimap avl;
+  auto avl_hint = avl.end_left();
+  for (int i = 1000; i > 0; i--) {
+    avl_hint = avl.insert(avl_hint, i, i);
+  }
+  EXPECT_EQ(avl.size(), 1000);
+  EXPECT_EQ(*avl.find_left(avl_hint, 777), 777);
+  EXPECT_EQ(*--avl.end_left(), 1000);
+}
+
+TEST(bimap, save_load) {
+  bimap<int, double> b;
+  for (int i = 0; i < 1000; i++) {
+    b.insert(i * 7 % 1000, -i * 0.5);
+  }
+  b.find_left(500);
+
+  std::stringstream stream;
+  b.save(stream);
+  auto loaded = bimap<int, double>::load(stream);
+  EXPECT_EQ(loaded, b);
+  EXPECT_EQ(loaded.at_right(-0.5), 7);
+  loaded.insert(1000, 1);
+  EXPECT_EQ(loaded.size(), 1001);
+
+  std::stringstream empty;
+  bimap<int, double>().save(empty);
+  EXPECT_TRUE((bimap<int, double>::load(empty).empty()));
+
+  std::stringstream other_types(stream.str());
+  EXPECT_THROW((bimap<int, int>::load(other_types)), std::runtime_error);
+  std::stringstream truncated(stream.str().substr(0, 5000));
+  EXPECT_THROW((bimap<int, double>::load(truncated)), std::runtime_error);
+
+  // pairs out of order
+  std::string data = stream.str();
+  std::swap(data[bimap_file_layout::align(sizeof(bimap_file_header))],
+            data[bimap_file_layout::align(sizeof(bimap_file_header)) + sizeof(int)]);
+  std::stringstream corrupted(data);
+  EXPECT_THROW((bimap<int, double>::load(corrupted)), std::runtime_error);
+
+  // a count far beyond the data does not allocate for it
+  data = stream.str();
+  std::uint64_t huge = UINT32_MAX;
+  std::memcpy(&data[offsetof(bimap_file_header, count)], &huge, sizeof(huge));
+  std::stringstream overstated(data);
+  EXPECT_THROW((bimap<int, double>::load(overstated)), std::runtime_error);
+}
+
+TEST(bimap, mapped) {
+  bimap<int, int> b;
+  for (int i = 0; i < 100; i++) {
+    b.insert(i, 100 - i);
+  }
+  std::string path = testing::TempDir() + "bimap_mapped_test.bin";
+  b.save_to_file(path);
+
+  mapped_bimap<int, int> m(path);
+  EXPECT_EQ(m.size(), 100);
+  EXPECT_EQ(m.at_left(3), 97);
+  EXPECT_EQ(m.at_right(3), 97);
+  EXPECT_THROW(m.at_left(100), std::out_of_range);
+  EXPECT_EQ(*m.lower_bound_left(-3), 0);
+  EXPECT_EQ(*m.upper_bound_right(99), 100);
+  EXPECT_EQ(m.upper_bound_left(99), m.end_left());
+  EXPECT_EQ(*--m.end_right(), 100);
+  EXPECT_EQ(*m.find_left(10).flip(), 90);
+  EXPECT_EQ(*m.find_right(10).flip(), 90);
+  EXPECT_EQ(m.find_right(0), m.end_right());
+
+  int expected = 1;
+  for (auto it = m.begin_right(); it != m.end_right(); ++it) {
+    EXPECT_EQ(*it, expected++);
+  }
+  EXPECT_EQ((bimap<int, int>::load_from_file(path)), b);
+
+  EXPECT_THROW((mapped_bimap<int, long long>(path)), std::runtime_error);
+
+  // a rank past the pairs is rejected on opening, not read through
+  {
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    std::uint32_t rank = 100;
+    file.seekp(bimap_file_layout(100, sizeof(int), sizeof(int)).ranks + 5 * sizeof(rank));
+    file.write(reinterpret_cast<char const *>(&rank), sizeof(rank));
+  }
+  EXPECT_THROW((mapped_bimap<int, int>(path)), std::runtime_error);
+  std::remove(path.c_str());
+  EXPECT_THROW((mapped_bimap<int, int>(path)), std::system_error);
+}
+
+TEST(bimap, order_statistics) {
+  bimap<int, int> b;
+  for (int i = 0; i < 100; i++) {
+    b.insert(2 * i, 1000 - i);
+  }
+
+  EXPECT_EQ(*b.nth_left(0), 0);
+  EXPECT_EQ(*b.nth_left(10), 20);
+  EXPECT_EQ(*b.nth_right(0), 901);
+  EXPECT_EQ(b.nth_left(100), b.end_left());
+  EXPECT_EQ(b.rank_left(20), 10);
+  EXPECT_EQ(b.rank_left(21), 11);
+  EXPECT_EQ(b.rank_left(-5), 0);
+  EXPECT_EQ(b.rank_right(1001), 100);
+  EXPECT_EQ(b.rank_left(b.find_left(50)), 25);
+  EXPECT_EQ(b.rank_right(b.end_right()), 100);
+  EXPECT_EQ(b.distance(b.find_left(10), b.find_left(30)), 10);
+  EXPECT_EQ(b.distance(b.end_right(), b.begin_right()), -100);
+
+  b.erase_left(b.find_left(10), b.find_left(30));
+  EXPECT_EQ(*b.nth_left(5), 30);
+  EXPECT_EQ(b.rank_right(b.find_right(996)), 85);
+  auto copy = b;
+  EXPECT_EQ(*copy.nth_right(85), 996);
+}
+
+template <typename Bimap>
+void check_order_statistics(uint32_t seed) {
+  Bimap b;
+  std::map<int, int> left_view, right_view;
+  auto check = [&](Bimap const &b) {
+    ASSERT_EQ(b.size(), left_view.size());
+    size_t k = 0;
+    for (auto [l, r] : left_view) {
+      EXPECT_EQ(*b.nth_left(k), l);
+      EXPECT_EQ(b.rank_left(l), k);
+      EXPECT_EQ(b.rank_left(l + 1), k + 1);
+      EXPECT_EQ(*b.nth_right(b.rank_right(r)), r);
+      k++;
+    }
+  };
+
+  std::mt19937 e(seed);
+  for (size_t i = 0; i < 20000; i++) {
+    int l = e() % 2000, r = e() % 2000;
+    switch (e() % 6) {
+    case 0:
+      if (b.erase_left(l)) {
+        right_view.erase(left_view[l]);
+        left_view.erase(l);
+      }
+      break;
+    case 1: {
+      auto first = b.lower_bound_right(r), last = b.upper_bound_right(r + 20);
+      for (auto it = first; it != last; ++it) {
+        left_view.erase(*it.flip());
+        right_view.erase(*it);
+      }
+      b.erase_right(first, last);
+      break;
+    }
+    case 2: {
+      auto node = b.extract_left(l);
+      if (node) {
+        b.insert(std::move(node));
+      }
+      break;
+    }
+    default:
+      if (b.insert(l, r) != b.end_left()) {
+        left_view[l] = r;
+        right_view[r] = l;
+      }
+    }
+    if (i % 2000 == 0) {
+      check(b);
+      check(Bimap(b));
+    }
+  }
+  check(b);
+}
+
+TEST(bimap_randomized, order_statistics) {
+  check_order_statistics<bimap<int, int>>(seed);
+  check_order_statistics<avl_bimap>(seed);
+}
+
+TEST(bimap_randomized, parallel_from_pairs) {
+  std::mt19937 e(seed);
+  std::vector<std::pair<uint32_t, uint32_t>> pairs;
+  std::vector<uint32_t> rights(100000);
+  for (uint32_t i = 0; i < rights.size(); i++) {
+    rights[i] = i;
+  }
+  std::shuffle(rights.begin(), rights.end(), e);
+  for (uint32_t i = 0; i < rights.size(); i++) {
+    pairs.emplace_back(i * 3, rights[i]);
+  }
+  std::shuffle(pairs.begin(), pairs.end(), e);
+
+  bimap<uint32_t, uint32_t> expected;
+  for (auto [l, r] : pairs) {
+    expected.insert(l, r);
+  }
+  auto b = bimap<uint32_t, uint32_t>::from_pairs(pairs, 4);
+  EXPECT_EQ(b, expected);
+  EXPECT_EQ(*b.nth_right(500).flip(), expected.at_right(500));
+  b.insert(1, 1000000);
+  EXPECT_EQ(b.size(), 100001);
+
+  std::atomic<uint64_t> sum = 0;
+  std::atomic<size_t> count = 0;
+  expected.for_each_pair([&](uint32_t l, uint32_t r) {
+    sum += uint64_t(l) * r;
+    count++;
+  }, 4);
+  uint64_t expected_sum = 0;
+  for (auto [l, r] : pairs) {
+    expected_sum += uint64_t(l) * r;
+  }
+  EXPECT_EQ(count, pairs.size());
+  EXPECT_EQ(sum, expected_sum);
+
+  pairs.push_back({3, 100000});
+  EXPECT_THROW((bimap<uint32_t, uint32_t>::from_pairs(pairs, 4)), std::invalid_argument);
+  pairs.back() = {1, 0};
+  EXPECT_THROW((bimap<uint32_t, uint32_t>::from_pairs(pairs, 4)), std::invalid_argument);
+}
+
+TEST(bimap_randomized, parallel_set_operations) {
+  using map_t = bimap<uint32_t, uint32_t>;
+  std::mt19937 e(seed);
+  map_t a, b;
+  for (size_t i = 0; i < 60000; i++) {
+    uint32_t l = e() % 100000, r = e() % 100000;
+    a.insert(l, r);
+    // a third of b agrees with a
+    if (e() % 3 == 0) {
+      b.insert(l, r);
+    } else {
+      b.insert(e() % 100000, e() % 100000);
+    }
+  }
+
+  map_t unite = a, intersect, subtract;
+  for (auto it = b.begin_left(); it != b.end_left(); ++it) {
+    unite.insert(*it, *it.flip());
+  }
+  for (auto it = a.begin_left(); it != a.end_left(); ++it) {
+    auto found = b.find_left(*it);
+    bool same = found != b.end_left() && *found.flip() == *it.flip();
+    (same ? intersect : subtract).insert(*it, *it.flip());
+  }
+
+  for (unsigned threads : {1u, 4u}) {
+    EXPECT_EQ(map_t::set_union(a, b, threads), unite);
+    EXPECT_EQ(map_t::set_intersection(a, b, threads), intersect);
+    EXPECT_EQ(map_t::set_difference(a, b, threads), subtract);
+  }
+  EXPECT_EQ(map_t::set_union(map_t(), b, 4), b);
+  EXPECT_TRUE(map_t::set_intersection(a, map_t(), 4).empty());
+  EXPECT_EQ(map_t::set_difference(a, map_t(), 4), a);
+}
+
+TEST(bimap, frozen) {
+  bimap<int, int> b;
+  std::mt19937 e(seed);
+  for (int i = 0; i < 1000; i++) {
+    b.insert(int(e() % 10000) * 2, int(e() % 10000) * 2);
+  }
+  frozen_bimap<int, int> f(b);
+  EXPECT_EQ(f.size(), b.size());
+  EXPECT_TRUE(std::equal(f.begin_left(), f.end_left(), b.view().begin_left(), b.view().end_left()));
+  EXPECT_TRUE(std::equal(f.begin_right(), f.end_right(), b.view().begin_right(), b.view().end_right()));
+
+  for (int key = -1; key <= 20001; key++) {
+    EXPECT_EQ(f.find_left(key) == f.end_left(), b.find_left(key) == b.end_left());
+    if (f.find_right(key) != f.end_right()) {
+      EXPECT_EQ(f.at_right(key), b.at_right(key));
+      EXPECT_EQ(*f.find_right(key).flip(), b.at_right(key));
+    } else {
+      EXPECT_THROW(f.at_right(key), std::out_of_range);
+    }
+
+    auto lb = f.lower_bound_left(key);
+    EXPECT_EQ(lb == f.end_left(), b.lower_bound_left(key) == b.end_left());
+    if (lb != f.end_left()) {
+      EXPECT_EQ(*lb, *b.lower_bound_left(key));
+      EXPECT_EQ(*lb.flip(), *b.lower_bound_left(key).flip());
+    }
+    auto ub = f.upper_bound_right(key);
+    EXPECT_EQ(ub == f.end_right(), b.upper_bound_right(key) == b.end_right());
+    if (ub != f.end_right()) {
+      EXPECT_EQ(*ub, *b.upper_bound_right(key));
+    }
+  }
+
+  frozen_bimap<int, int> empty;
+  EXPECT_TRUE(empty.empty());
+  EXPECT_EQ(empty.find_left(0), empty.end_left());
+  EXPECT_EQ(empty.lower_bound_right(0), empty.end_right());
+}
+
+struct runtime_order {
+  bool descending = false;
+  bool operator()(int a, int b) const {
+    return descending ? b < a : a < b;
+  }
+};
+
+TEST(bimap, frozen_takes_comparators) {
+  bimap<int, int, runtime_order, runtime_order> b(runtime_order{true}, runtime_order{true});
+  for (int i = 0; i < 100; i++) {
+    b.insert(i, i * 3);
+  }
+  EXPECT_TRUE(b.key_comp_left().descending);
+
+  frozen_bimap<int, int, runtime_order, runtime_order> f(b);
+  EXPECT_EQ(*f.begin_left(), 99);
+  for (int i = 0; i < 100; i++) {
+    EXPECT_EQ(f.at_left(i), i * 3);
+    EXPECT_EQ(f.at_right(i * 3), i);
+  }
+  EXPECT_EQ(*f.lower_bound_left(1000), 99);
+  EXPECT_EQ(f.find_left(100), f.end_left());
+}
+
+using hashed_bimap = bimap<int, int, std::less<int>, std::less<int>,
+                           std::allocator<splay_tree<int, int>>, splay_policy,
+                           hash_index<std::hash<int>, std::hash<int>>>;
+
+TEST(bimap, hash_index) {
+  hashed_bimap b;
+  for (int i = 0; i < 1000; i++) {
+    b.insert(i * 1024, -i);
+  }
+  EXPECT_EQ(b.insert(0, 5), b.end_left());
+  EXPECT_EQ(b.at_left(1024 * 10), -10);
+  EXPECT_EQ(b.at_right(-999), 999 * 1024);
+  EXPECT_THROW(b.at_left(1), std::out_of_range);
+  EXPECT_EQ(b.find_right(1), b.end_right());
+  EXPECT_EQ(*b.lower_bound_left(1), 1024);
+
+  EXPECT_TRUE(b.erase_left(0));
+  EXPECT_FALSE(b.erase_left(0));
+  EXPECT_TRUE(b.erase_right(-1));
+  b.erase_left(b.find_left(100 * 1024), b.find_left(900 * 1024));
+  EXPECT_EQ(b.size(), 198);
+  EXPECT_EQ(b.find_left(500 * 1024), b.end_left());
+  EXPECT_EQ(b.find_right(-500), b.end_right());
+  EXPECT_EQ(b.at_left(900 * 1024), -900);
+
+  EXPECT_EQ(b.at_left_or_default(7), 0);
+  EXPECT_EQ(b.at_right(0), 7);
+
+  hashed_bimap copy(b);
+  EXPECT_EQ(copy.at_right(-950), 950 * 1024);
+  hashed_bimap moved(std::move(copy));
+  EXPECT_EQ(moved.at_left(950 * 1024), -950);
+  EXPECT_EQ(moved.view().at_right(0), 7);
+  copy = moved;
+  EXPECT_EQ(copy.at_left(7), 0);
+
+  std::vector<std::pair<int, int>> sorted = {{1, 3}, {2, 1}, {3, 2}};
+  auto s = hashed_bimap::from_sorted(sorted);
+  EXPECT_EQ(s.at_right(1), 2);
+
+  bimap<int, int, std::less<int>, std::less<int>, std::allocator<splay_tree<int, int>>,
+        avl_policy, hash_index<std::hash<int>>> one_side;
+  one_side.insert(1, 2);
+  EXPECT_EQ(one_side.at_left(1), 2);
+  EXPECT_EQ(one_side.at_right(2), 1);
+}
+
+TEST(bimap_randomized, hash_index_compare_to_map) {
+  hashed_bimap b;
+  std::map<int, int> left_view;
+
+  std::mt19937 e(seed);
+  for (size_t i = 0; i < 50000; i++) {
+    int key = e() % 5000;
+    if (e() % 3) {
+      if (b.insert(key, key * 7) != b.end_left()) {
+        left_view.insert({key, key * 7});
+      }
+    } else {
+      EXPECT_EQ(b.erase_left(key), left_view.erase(key) == 1);
+    }
+    int probe = e() % 5000;
+    auto it = left_view.find(probe);
+    if (it == left_view.end()) {
+      EXPECT_EQ(b.find_left(probe), b.end_left());
+      EXPECT_EQ(b.find_right(probe * 7), b.end_right());
+    } else {
+      EXPECT_EQ(b.at_left(probe), it->second);
+      EXPECT_EQ(b.at_right(probe * 7), probe);
+    }
+  }
+  EXPECT_EQ(b.size(), left_view.size());
+}
+
+TEST(bimap, split_join) {
+  bimap<int, int> b;
+  for (int i = 0; i < 100; i++) {
+    b.insert(i, 1000 - i);
+  }
+
+  auto upper = b.split_left(90);
+  EXPECT_EQ(b.size(), 90);
+  EXPECT_EQ(upper.size(), 10);
+  EXPECT_EQ(*upper.begin_left(), 90);
+  EXPECT_EQ(upper.at_right(901), 99);
+  EXPECT_EQ(b.find_right(901), b.end_right());
+  EXPECT_EQ(*b.nth_right(0), 911);
+
+  auto lower = std::move(b);
+  b = lower.split_left(10);
+  EXPECT_EQ(lower.size(), 10);
+  EXPECT_EQ(b.size(), 80);
+  EXPECT_EQ(*--lower.end_left(), 9);
+  EXPECT_TRUE(b.split_left(1000).empty());
+  EXPECT_EQ(b.size(), 80);
+
+  bimap<int, int> overlapping;
+  overlapping.insert(5, 1);
+  EXPECT_THROW(lower.join(std::move(overlapping)), std::invalid_argument);
+  overlapping = bimap<int, int>();
+  overlapping.insert(200, 995);
+  EXPECT_THROW(lower.join(std::move(overlapping)), std::invalid_argument);
+  EXPECT_EQ(lower.size(), 10);
+  EXPECT_EQ(overlapping.size(), 1);
+
+  b.join(std::move(upper));
+  b.join(std::move(lower));
+  EXPECT_TRUE(upper.empty());
+  EXPECT_EQ(b.size(), 100);
+  EXPECT_EQ(b.at_left(95), 905);
+  EXPECT_EQ(*b.nth_left(9), 9);
+
+  auto rights = b.split_right(950);
+  EXPECT_EQ(rights.size(), 51);
+  EXPECT_EQ(*rights.begin_left(), 0);
+  EXPECT_EQ(*b.begin_left(), 51);
+}
+
+template <typename Bimap>
+void check_split_join(uint32_t seed) {
+  std::mt19937 e(seed);
+  auto check = [](Bimap const &b, std::map<int, int> const &expected) {
+    ASSERT_EQ(b.size(), expected.size());
+    size_t k = 0;
+    for (auto [l, r] : expected) {
+      EXPECT_EQ(b.at_left(l), r);
+      EXPECT_EQ(b.at_right(r), l);
+      EXPECT_EQ(*b.nth_left(k), l);
+      EXPECT_EQ(*b.nth_right(b.rank_right(r)), r);
+      k++;
+    }
+    auto it = b.end_right();
+    for (k = 0; k < expected.size(); k++) {
+      --it;
+    }
+    EXPECT_EQ(it, b.begin_right());
+  };
+
+  for (size_t round = 0; round < 40; round++) {
+    Bimap b;
+    std::map<int, int> pairs;
+    size_t size = e() % 3 == 0 ? e() % 20 : e() % 3000;
+    for (size_t i = 0; i < size; i++) {
+      int l = e() % 10000, r = e() % 10000;
+      if (b.insert(l, r) != b.end_left()) {
+        pairs[l] = r;
+      }
+    }
+
+    // splits near the ends move a few pairs, in the middle -- rebuild
+    int key = e() % 2 ? e() % 10000 : (e() % 2 ? e() % 100 : 9900 + e() % 100);
+    std::map<int, int> upper_pairs(pairs.lower_bound(key), pairs.end());
+    std::map<int, int> lower_pairs(pairs.begin(), pairs.lower_bound(key));
+    Bimap upper = b.split_left(key);
+    check(b, lower_pairs);
+    check(upper, upper_pairs);
+
+    if (e() % 2) {
+      b.join(std::move(upper));
+    } else {
+      upper.join(std::move(b));
+      b = std::move(upper);
+    }
+    check(b, pairs);
+
+    Bimap other;
+    std::map<int, int> merged = pairs, left_over;
+    std::map<int, int> taken_rights;
+    for (auto [l, r] : pairs) {
+      taken_rights[r] = l;
+    }
+    size_t other_size = e() % 2 ? e() % 30 : e() % 3000;
+    std::map<int, int> other_pairs;
+    for (size_t i = 0; i < other_size; i++) {
+      int l = e() % 10000, r = e() % 10000;
+      if (other.insert(l, r) != other.end_left()) {
+        other_pairs[l] = r;
+      }
+    }
+    for (auto [l, r] : other_pairs) {
+      if (merged.count(l) || taken_rights.count(r)) {
+        left_over[l] = r;
+      } else {
+        merged[l] = r;
+        taken_rights[r] = l;
+      }
+    }
+    b.merge(other);
+    check(b, merged);
+    check(other, left_over);
+  }
+}
+
+TEST(bimap_randomized, split_join_merge) {
+  check_split_join<bimap<int, int>>(seed);
+  check_split_join<avl_bimap>(seed);
+  check_split_join<hashed_bimap>(seed);
+}
+
+template <typename TreePolicy>
+using counting_bimap = bimap<int, int, std::less<int>, std::less<int>,
+                             std::allocator<splay_tree<int, int>>, TreePolicy, hash_index<>,
+                             counting_stats>;
+
+TEST(bimap, stats) {
+  EXPECT_EQ(bimap_side_stats::depth_bucket(0), 0);
+  EXPECT_EQ(bimap_side_stats::depth_bucket(1), 1);
+  EXPECT_EQ(bimap_side_stats::depth_bucket(3), 2);
+  EXPECT_EQ(bimap_side_stats::depth_bucket(999), 10);
+
+  counting_bimap<splay_policy> b;
+  EXPECT_EQ(b.stats().left.height, 0);
+  for (int i = 0; i < 1000; i++) {
+    b.insert(i, -i);
+  }
+  // sorted inserts splay nothing and leave a path
+  bimap_stats s = b.stats();
+  EXPECT_EQ(s.inserts, 1000);
+  EXPECT_EQ(s.left.zigs, 0);
+  EXPECT_EQ(s.left.height, 1000);
+  EXPECT_EQ(s.right.height, 1000);
+  EXPECT_GT(s.left.comparisons, 0);
+
+  EXPECT_EQ(b.at_left(0), 0);
+  EXPECT_EQ(b.find_right(1), b.end_right());
+  b.lower_bound_left(500);
+  b.erase_left(1);
+  b.erase_right(b.find_right(-2));
+  b.erase_left(b.lower_bound_left(10), b.lower_bound_left(20));
+  s = b.stats();
+  EXPECT_EQ(s.left.finds, 2);
+  EXPECT_EQ(s.right.finds, 2);
+  EXPECT_EQ(s.left.find_depth[10], 1);
+  b.insert(0, 5);
+  EXPECT_EQ(b.stats().inserts, 1001);
+  EXPECT_EQ(s.left.bounds, 3);
+  EXPECT_EQ(s.left.erases, 11);
+  EXPECT_EQ(s.right.erases, 1);
+  EXPECT_GT(s.left.zigs, 0);
+  EXPECT_LT(s.left.height, 1000);
+
+  b.reset_stats();
+  for (auto it = b.begin_left(); it != b.end_left(); ++it) {
+  }
+  s = b.stats();
+  EXPECT_EQ(s.inserts, 0);
+  EXPECT_EQ(s.left.finds, 0);
+  uint64_t steps = 0;
+  for (uint64_t count : s.left.step_depth) {
+    steps += count;
+  }
+  EXPECT_EQ(steps, b.size() - 1);
+
+  counting_bimap<avl_policy> avl;
+  for (int i = 0; i < 1000; i++) {
+    avl.insert(i, -i);
+  }
+  avl.find_left(500);
+  s = avl.stats();
+  EXPECT_EQ(s.left.zigs, 0);
+  EXPECT_LE(s.left.height, 14);
+  EXPECT_EQ(s.left.finds, 1);
+
+  frozen_bimap<int, int> frozen(avl);
+  EXPECT_EQ(frozen.size(), 1000);
+  EXPECT_EQ(frozen.at_left(7), -7);
+
+  bimap<int, int> plain;
+  plain.insert(1, 2);
+  plain.insert(2, 1);
+  EXPECT_EQ(plain.stats().inserts, 0);
+  EXPECT_EQ(plain.stats().left.height, 2);
+}
+
+TEST(bimap, compact) {
+  compact_bimap<int, int> b;
+  EXPECT_EQ(b.begin_left(), b.end_left());
+  for (int i = 0; i < 100; i++) {
+    EXPECT_NE(b.insert(i, 100 - i), b.end_left());
+  }
+  EXPECT_EQ(b.insert(5, 1000), b.end_left());
+  EXPECT_EQ(b.insert(1000, 5), b.end_left());
+  EXPECT_EQ(b.size(), 100);
+  EXPECT_EQ(b.at_left(3), 97);
+  EXPECT_EQ(b.at_right(3), 97);
+  EXPECT_THROW(b.at_left(100), std::out_of_range);
+  EXPECT_EQ(*b.lower_bound_left(-3), 0);
+  EXPECT_EQ(*b.upper_bound_right(99), 100);
+  EXPECT_EQ(b.upper_bound_left(99), b.end_left());
+  EXPECT_EQ(*--b.end_right(), 100);
+  EXPECT_EQ(*b.find_left(10).flip(), 90);
+
+  EXPECT_TRUE(b.erase_left(0));
+  EXPECT_FALSE(b.erase_left(0));
+  EXPECT_TRUE(b.erase_right(1));
+  b.erase_left(b.find_left(50));
+  EXPECT_EQ(b.size(), 97);
+  EXPECT_EQ(b.at_right(100 - 98), 98);
+  EXPECT_EQ(*b.begin_left(), 1);
+}
+
+TEST(bimap_randomized, compact_compare_to_two_maps) {
+  compact_bimap<uint32_t, uint32_t> b;
+  std::map<uint32_t, uint32_t> left_view, right_view;
+
+  std::mt19937 e(seed);
+  for (size_t i = 0; i < 50000; i++) {
+    if (e() % 3) {
+      uint32_t l = e() % 10000, r = e() % 10000;
+      auto inserted = b.insert(l, r);
+      if (inserted != b.end_left()) {
+        EXPECT_EQ(*inserted, l);
+        EXPECT_EQ(++inserted, b.upper_bound_left(l));
+        left_view.insert({l, r});
+        right_view.insert({r, l});
+      }
+    } else if (!b.empty()) {
+      auto it = b.lower_bound_right(e() % 10000);
+      if (it == b.end_right()) {
+        continue;
+      }
+      EXPECT_EQ(right_view.erase(*it), 1);
+      EXPECT_EQ(left_view.erase(*it.flip()), 1);
+      b.erase_right(it);
+    }
+    if (i % 1000 == 0) {
+      EXPECT_EQ(b.size(), left_view.size());
+      auto mit = right_view.begin();
+      for (auto it = b.begin_right(); it != b.end_right(); ++it, ++mit) {
+        EXPECT_EQ(*it, mit->first);
+        EXPECT_EQ(*it.flip(), mit->second);
+      }
+    }
+  }
+}
+
+TEST(bimap, persistent) {
+  persistent_bimap<int, int> b;
+  EXPECT_EQ(b.begin_left(), b.end_left());
+  for (int i = 0; i < 100; i++) {
+    EXPECT_NE(b.insert(i, 100 - i), b.end_left());
+  }
+  EXPECT_EQ(b.insert(5, 1000), b.end_left());
+  EXPECT_EQ(b.insert(1000, 5), b.end_left());
+
+  auto old = b.snapshot();
+  EXPECT_TRUE(b.erase_left(0));
+  EXPECT_FALSE(b.erase_left(0));
+  EXPECT_TRUE(b.erase_right(1));
+  b.insert(1000, 1000);
+
+  EXPECT_EQ(b.size(), 99);
+  EXPECT_EQ(b.at_left(3), 97);
+  EXPECT_EQ(b.at_right(1000), 1000);
+  EXPECT_THROW(b.at_left(0), std::out_of_range);
+  EXPECT_EQ(*b.lower_bound_left(-3), 1);
+  EXPECT_EQ(*b.upper_bound_right(99), 1000);
+  EXPECT_EQ(b.upper_bound_left(1000), b.end_left());
+  EXPECT_EQ(*b.find_left(10).flip(), 90);
+  EXPECT_EQ(*b.find_right(90).flip(), 10);
+
+  EXPECT_EQ(old.size(), 100);
+  EXPECT_EQ(old.at_left(0), 100);
+  EXPECT_EQ(old.at_right(1), 99);
+  EXPECT_EQ(old.find_left(1000), old.end_left());
+  int expected = 0;
+  for (auto it = old.begin_left(); it != old.end_left(); ++it) {
+    EXPECT_EQ(*it, expected++);
+  }
+  EXPECT_EQ(expected, 100);
+}
+
+TEST(bimap, persistent_snapshot_concurrent_reads) {
+  persistent_bimap<int, int> b;
+  for (int i = 0; i < 1000; i++) {
+    b.insert(i, -i);
+  }
+
+  auto version = b.snapshot();
+  std::vector<std::thread> readers;
+  for (int k = 0; k < 4; k++) {
+    readers.emplace_back([version] {
+      for (int i = 0; i < 1000; i++) {
+        EXPECT_EQ(version.at_left(i), -i);
+      }
+      EXPECT_EQ(version.size(), 1000);
+    });
+  }
+  for (int i = 0; i < 1000; i += 2) {
+    b.erase_left(i);
+    b.insert(i + 5000, i);
+  }
+  for (auto &t : readers) {
+    t.join();
+  }
+
+  EXPECT_EQ(b.size(), 1000);
+  EXPECT_EQ(b.at_right(0), 5000);
+  EXPECT_EQ(version.at_right(0), 0);
+}
+
+TEST(bimap, persistent_insert_returns_moved_key) {
+  persistent_bimap<std::string, int> b;
+  for (int i = 0; i < 100; i++) {
+    std::string key = std::to_string(i);
+    auto it = b.insert(std::move(key), i);
+    EXPECT_EQ(*it, std::to_string(i));
+    EXPECT_EQ(it, b.find_left(std::to_string(i)));
+    EXPECT_EQ(*it.flip(), i);
+  }
+  EXPECT_EQ(b.insert(std::string("5"), 1000), b.end_left());
+}
+
+struct throwing_key {
+  // copies left before the next one throws, negative for never
+  static inline int copies_left = -1;
+  int value;
+  explicit throwing_key(int value) : value(value) {}
+  throwing_key(throwing_key const &other) : value(other.value) {
+    if (copies_left == 0) {
+      throw std::bad_alloc();
+    }
+    if (copies_left > 0) {
+      copies_left--;
+    }
+  }
+  friend bool operator<(throwing_key const &a, throwing_key const &b) {
+    return a.value < b.value;
+  }
+};
+
+TEST(bimap, persistent_throwing_copy_keeps_version) {
+  persistent_bimap<throwing_key, int> b;
+  for (int i = 0; i < 200; i++) {
+    b.insert(throwing_key(i * 2), i);
+  }
+
+  auto check = [&b] {
+    EXPECT_EQ(b.size(), 200);
+    int expected = 0;
+    for (auto it = b.begin_left(); it != b.end_left(); ++it, expected += 2) {
+      EXPECT_EQ(it->value, expected);
+    }
+    EXPECT_EQ(expected, 400);
+  };
+  for (int fail_after = 0; fail_after < 20; fail_after++) {
+    throwing_key::copies_left = fail_after;
+    try {
+      b.insert(throwing_key(201), 1000);
+      throwing_key::copies_left = -1;
+      b.erase_left(throwing_key(201));
+    } catch (std::bad_alloc const &) {
+      throwing_key::copies_left = -1;
+    }
+    check();
+
+    throwing_key::copies_left = fail_after;
+    try {
+      if (b.erase_left(throwing_key(100))) {
+        throwing_key::copies_left = -1;
+        b.insert(throwing_key(100), 50);
+      }
+    } catch (std::bad_alloc const &) {
+      throwing_key::copies_left = -1;
+    }
+    check();
+  }
+}
+
+TEST(bimap_randomized, persistent_compare_to_two_maps) {
+  persistent_bimap<uint32_t, uint32_t> b;
+  std::map<uint32_t, uint32_t> left_view, right_view;
+  std::vector<std::pair<persistent_bimap<uint32_t, uint32_t>, std::map<uint32_t, uint32_t>>> versions;
+
+  std::mt19937 e(seed);
+  for (size_t i = 0; i < 50000; i++) {
+    if (e() % 3) {
+      uint32_t l = e() % 10000, r = e() % 10000;
+      auto inserted = b.insert(l, r);
+      if (inserted != b.end_left()) {
+        EXPECT_EQ(*inserted, l);
+        EXPECT_EQ(++inserted, b.upper_bound_left(l));
+        left_view.insert({l, r});
+        right_view.insert({r, l});
+      }
+    } else if (!b.empty()) {
+      auto it = b.lower_bound_right(e() % 10000);
+      if (it == b.end_right()) {
+        continue;
+      }
+      uint32_t r = *it;
+      EXPECT_EQ(left_view.erase(*it.flip()), 1);
+      EXPECT_EQ(right_view.erase(r), 1);
+      EXPECT_TRUE(b.erase_right(r));
+    }
+    if (i % 5000 == 0) {
+      versions.emplace_back(b.snapshot(), left_view);
+    }
+  }
+
+  versions.emplace_back(b, left_view);
+  for (auto const &[version, view] : versions) {
+    EXPECT_EQ(version.size(), view.size());
+    auto mit = view.begin();
+    for (auto it = version.begin_left(); it != version.end_left(); ++it, ++mit) {
+      EXPECT_EQ(*it, mit->first);
+      EXPECT_EQ(version.at_left(*it), mit->second);
+      EXPECT_EQ(version.at_right(mit->second), *it);
+    }
+  }
+}
+
+TEST(bimap, concurrent) {
+  concurrent_bimap<int, int> b(4);
+  EXPECT_TRUE(b.empty());
+  for (int i = 0; i < 100; i++) {
+    EXPECT_TRUE(b.insert(i, 100 - i));
+  }
+  EXPECT_FALSE(b.insert(5, 1000));
+  EXPECT_FALSE(b.insert(1000, 5));
+  EXPECT_EQ(b.size(), 100);
+  EXPECT_EQ(b.at_left(3), 97);
+  EXPECT_EQ(b.at_right(3), 97);
+  EXPECT_THROW(b.at_left(100), std::out_of_range);
+  EXPECT_EQ(b.find_right(1000), std::nullopt);
+
+  EXPECT_TRUE(b.erase_left(0));
+  EXPECT_FALSE(b.erase_left(0));
+  EXPECT_TRUE(b.erase_right(1));
+  EXPECT_FALSE(b.erase_right(1));
+  EXPECT_EQ(b.size(), 98);
+  EXPECT_TRUE(b.insert(0, 1));
+  EXPECT_EQ(b.at_right(1), 0);
+}
+
+namespace {
+struct ci_less {
+  bool operator()(std::string const &a, std::string const &b) const {
+    return std::lexicographical_compare(
+        a.begin(), a.end(), b.begin(), b.end(),
+        [](char x, char y) { return std::tolower(x) < std::tolower(y); });
+  }
+};
+
+struct ci_hash {
+  size_t operator()(std::string const &s) const {
+    std::string lower(s);
+    for (char &c : lower) {
+      c = static_cast<char>(std::tolower(c));
+    }
+    return std::hash<std::string>()(lower);
+  }
+};
+} // namespace
+
+TEST(bimap, concurrent_erase_equivalent_right) {
+  concurrent_bimap<int, std::string, std::less<int>, ci_less,
+                   std::hash<int>, ci_hash> b(4);
+  EXPECT_TRUE(b.insert(1, "abc"));
+  EXPECT_FALSE(b.insert(2, "ABC"));
+  EXPECT_TRUE(b.erase_right("ABC"));
+  EXPECT_TRUE(b.empty());
+}
+
+TEST(bimap_randomized, concurrent_writers) {
+  concurrent_bimap<uint32_t, uint32_t> b(8);
+  constexpr uint32_t keys = 2000;
+
+  // writers race for the same keys on both sides
+  std::vector<std::thread> writers;
+  for (uint32_t t = 0; t < 4; t++) {
+    writers.emplace_back([&b, t] {
+      std::mt19937 e(t);
+      for (size_t i = 0; i < 20000; i++) {
+        uint32_t l = e() % keys, r = e() % keys;
+        switch (e() % 4) {
+        case 0:
+          b.erase_left(l);
+          break;
+        case 1:
+          b.erase_right(r);
+          break;
+        default:
+          b.insert(l, r);
+        }
+      }
+    });
+  }
+  for (auto &w : writers) {
+    w.join();
+  }
+
+  size_t pairs = 0;
+  for (uint32_t l = 0; l < keys; l++) {
+    if (auto r = b.find_left(l)) {
+      EXPECT_EQ(b.at_right(*r), l);
+      pairs++;
+    }
+  }
+  for (uint32_t r = 0; r < keys; r++) {
+    if (auto l = b.find_right(r)) {
+      EXPECT_EQ(b.at_left(*l), r);
+    }
+  }
+  EXPECT_EQ(b.size(), pairs);
+}
+
+TEST(bimap, transparent_lookup) {
+  bimap<std::string, int, std::less<>> b;
+  b.insert("apple", 1);
+  b.insert("banana", 2);
+  b.insert("cherry", 3);
+
+  std::string_view key = "banana";
+  EXPECT_EQ(b.at_left(key), 2);
+  EXPECT_EQ(b.at_left("cherry"), 3);
+  EXPECT_EQ(*b.find_left(key).flip(), 2);
+  EXPECT_EQ(b.find_left("durian"), b.end_left());
+  EXPECT_THROW(b.at_left("durian"), std::out_of_range);
+  EXPECT_EQ(*b.lower_bound_left("b"), "banana");
+  EXPECT_EQ(*b.upper_bound_left(key), "cherry");
+
+  auto v = b.view();
+  EXPECT_EQ(v.at_left(key), 2);
+  EXPECT_EQ(*v.lower_bound_left("c"), "cherry");
+  EXPECT_EQ(v.find_left("durian"), v.end_left());
+}
+
+struct counted_key {
+  static inline int constructed = 0;
+  int value;
+  explicit counted_key(int value) : value(value) {
+    constructed++;
+  }
+  counted_key(counted_key const &other) : value(other.value) {
+    constructed++;
+  }
+};
+
+struct counted_key_less {
+  using is_transparent = void;
+  bool operator()(counted_key const &a, counted_key const &b) const {
+    return a.value < b.value;
+  }
+  bool operator()(counted_key const &a, int b) const {
+    return a.value < b;
+  }
+  bool operator()(int a, counted_key const &b) const {
+    return a < b.value;
+  }
+};
+
+TEST(bimap, transparent_lookup_constructs_no_keys) {
+  bimap<int, counted_key, std::less<int>, counted_key_less> b;
+  for (int i = 0; i < 100; i++) {
+    b.insert(i, counted_key(i * 2));
+  }
+
+  counted_key::constructed = 0;
+  for (int i = 0; i < 200; i++) {
+    if (i % 2 == 0) {
+      EXPECT_EQ(b.at_right(i), i / 2);
+    } else {
+      EXPECT_EQ(b.find_right(i), b.end_right());
+    }
+    if (i < 198) {
+      EXPECT_EQ((*b.lower_bound_right(i)).value, i % 2 ? i + 1 : i);
+    }
+  }
+  EXPECT_EQ(counted_key::constructed, 0);
+}
+
+TEST(bimap_stress, sorted_keys) {
+  // sorted inserts make a path of depth n, nothing may recurse over it
+  size_t const total = 1000000;
+  {
+    bimap<size_t, size_t> b;
+    for (size_t i = 0; i < total; i++) {
+      b.insert(i, total - i);
+    }
+    EXPECT_EQ(b.at_left(0), total);
+    EXPECT_EQ(b.find_right(total + 1), b.end_right());
+    EXPECT_EQ(*b.lower_bound_left(total / 2), total / 2);
+  }
+  {
+    bimap<size_t, size_t> b;
+    for (size_t i = 0; i < total; i++) {
+      b.insert(i, i);
+    }
+    bimap<size_t, size_t> copy(b);
+    EXPECT_EQ(copy.size(), total);
+  }
+}
+
 TEST(bimap_randomized, comparison) {
   std::cout << "Seed used for randomized compare test is " << seed << std::endl;
 
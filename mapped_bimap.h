@@ -0,0 +1,295 @@
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "bimap.h"
+
+/**
+ * Read only bimap over a file written by bimap::save_to_file. The file is
+ * mapped into memory and searched in place: lefts and rights are stored
+ * sorted, so nothing is deserialized: opening only checks the ranks of
+ * the rights, other pages are read in by the first lookups touching them.
+ * POSIX only.
+ */
+template <typename Left, typename Right,
+    typename CompareLeft = std::less<Left>, typename CompareRight = std::less<Right>>
+struct mapped_bimap {
+  using left_t = Left;
+  using right_t = Right;
+
+  static_assert(std::is_trivially_copyable_v<left_t> && std::is_trivially_copyable_v<right_t>,
+                "mapped_bimap - left_t and right_t have to be trivially copyable");
+  static_assert(alignof(left_t) <= bimap_file_layout::alignment &&
+                alignof(right_t) <= bimap_file_layout::alignment,
+                "mapped_bimap - left_t and right_t are over-aligned");
+
+private:
+  template <typename Tag>
+  struct iterator {
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = std::conditional_t<std::is_same_v<Tag, left_tag>, left_t, right_t>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = value_type const *;
+    using reference = value_type const &;
+
+    reference operator*() const {
+      if constexpr (std::is_same_v<Tag, left_tag>) {
+        return bmp->lefts[rank];
+      } else {
+        return bmp->sorted_rights[rank];
+      }
+    }
+
+    iterator &operator++() {
+      rank++;
+      return *this;
+    }
+    iterator operator++(int) {
+      iterator old = *this;
+      ++*this;
+
+      return old;
+    }
+
+    iterator &operator--() {
+      rank--;
+      return *this;
+    }
+    iterator operator--(int) {
+      iterator old = *this;
+      --*this;
+
+      return old;
+    }
+
+    // Итератор на ту же пару с другой стороны, слева направо -- за O(log n)
+    auto flip() const {
+      if constexpr (std::is_same_v<Tag, left_tag>) {
+        return rank == bmp->size() ? bmp->end_right() : bmp->find_right(bmp->rights[rank]);
+      } else {
+        std::size_t res = rank == bmp->size() ? rank : bmp->ranks[rank];
+        return iterator<left_tag>(res, bmp);
+      }
+    }
+
+    bool operator==(iterator const &other) const {
+      return rank == other.rank;
+    }
+    bool operator!=(iterator const &other) const {
+      return rank != other.rank;
+    }
+
+    iterator(std::size_t rank, mapped_bimap const *bmp) : rank(rank), bmp(bmp) {}
+
+  private:
+    friend mapped_bimap;
+    std::size_t rank;
+    mapped_bimap const *bmp;
+  };
+
+  /**
+   * rank of the first key not less than (upper: greater than) value, size if none
+   */
+  template <typename T, typename Compare>
+  std::size_t search(T const *keys, T const &value, Compare const &compare, bool lower_bound) const {
+    T const *res = lower_bound ? std::lower_bound(keys, keys + count, value, compare)
+                               : std::upper_bound(keys, keys + count, value, compare);
+    return static_cast<std::size_t>(res - keys);
+  }
+
+  template <typename T, typename Compare>
+  std::size_t find(T const *keys, T const &value, Compare const &compare) const {
+    std::size_t rank = search(keys, value, compare, true);
+    if (rank != count && compare(value, keys[rank])) {
+      return count;
+    }
+    return rank;
+  }
+
+  void unmap() noexcept {
+    if (data) {
+      munmap(data, mapped_size);
+    }
+  }
+
+  /**
+   * Mapped bimap fields
+   */
+  void *data = nullptr;
+  std::size_t mapped_size = 0;
+  std::size_t count = 0;
+  left_t const *lefts = nullptr;
+  right_t const *rights = nullptr;
+  right_t const *sorted_rights = nullptr;
+  std::uint32_t const *ranks = nullptr;
+  CompareLeft compare_left;
+  CompareRight compare_right;
+
+public:
+  using left_iterator = iterator<left_tag>;
+  using right_iterator = iterator<right_tag>;
+
+  // Отображает в память файл, записанный bimap::save_to_file.
+  // Если файл нельзя открыть или отобразить, бросает std::system_error,
+  // если он записан не для этих типов, обрезан или ссылается за пределы
+  // пар -- std::runtime_error. Открытие проверяет ранги правых за O(n),
+  // порядок пар в файле не проверяется.
+  explicit mapped_bimap(std::string const &path,
+                        CompareLeft compare_left = CompareLeft(),
+                        CompareRight compare_right = CompareRight())
+      : compare_left(std::move(compare_left)), compare_right(std::move(compare_right)) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::system_error(errno, std::generic_category(), "mapped_bimap - cannot open " + path);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      int error = errno;
+      close(fd);
+      throw std::system_error(error, std::generic_category(), "mapped_bimap - cannot stat " + path);
+    }
+    mapped_size = static_cast<std::size_t>(st.st_size);
+    if (mapped_size < sizeof(bimap_file_header)) {
+      close(fd);
+      throw std::runtime_error("mapped_bimap - not a bimap file");
+    }
+
+    data = mmap(nullptr, mapped_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int error = errno;
+    close(fd);
+    if (data == MAP_FAILED) {
+      data = nullptr;
+      throw std::system_error(error, std::generic_category(), "mapped_bimap - cannot map " + path);
+    }
+
+    try {
+      auto const &header = *static_cast<bimap_file_header const *>(data);
+      bimap_file_layout::check(header, sizeof(left_t), sizeof(right_t), "mapped_bimap");
+      bimap_file_layout layout(header.count, sizeof(left_t), sizeof(right_t));
+      if (layout.size > mapped_size) {
+        throw std::runtime_error("mapped_bimap - truncated file");
+      }
+
+      auto const *base = static_cast<unsigned char const *>(data);
+      count = header.count;
+      lefts = reinterpret_cast<left_t const *>(base + layout.lefts);
+      rights = reinterpret_cast<right_t const *>(base + layout.rights);
+      sorted_rights = reinterpret_cast<right_t const *>(base + layout.sorted_rights);
+      ranks = reinterpret_cast<std::uint32_t const *>(base + layout.ranks);
+
+      // lookups by right index lefts with ranks, a corrupt file must not read past them
+      for (std::size_t i = 0; i < count; i++) {
+        if (ranks[i] >= count) {
+          throw std::runtime_error("mapped_bimap - rank out of range");
+        }
+      }
+    } catch (...) {
+      unmap();
+      throw;
+    }
+  }
+
+  mapped_bimap(mapped_bimap &&other) noexcept
+      : data(std::exchange(other.data, nullptr)), mapped_size(std::exchange(other.mapped_size, 0)),
+        count(std::exchange(other.count, 0)), lefts(other.lefts), rights(other.rights),
+        sorted_rights(other.sorted_rights), ranks(other.ranks),
+        compare_left(std::move(other.compare_left)), compare_right(std::move(other.compare_right)) {}
+
+  mapped_bimap &operator=(mapped_bimap &&other) noexcept {
+    mapped_bimap tmp(std::move(other));
+    std::swap(data, tmp.data);
+    std::swap(mapped_size, tmp.mapped_size);
+    std::swap(count, tmp.count);
+    std::swap(lefts, tmp.lefts);
+    std::swap(rights, tmp.rights);
+    std::swap(sorted_rights, tmp.sorted_rights);
+    std::swap(ranks, tmp.ranks);
+    std::swap(compare_left, tmp.compare_left);
+    std::swap(compare_right, tmp.compare_right);
+    return *this;
+  }
+
+  mapped_bimap(mapped_bimap const &) = delete;
+  mapped_bimap &operator=(mapped_bimap const &) = delete;
+
+  // Снимает отображение, инвалидирует все итераторы и ссылки
+  ~mapped_bimap() {
+    unmap();
+  }
+
+  // Поиск элемента, возвращает итератор на него или end, если не нашел
+  left_iterator find_left(left_t const &left) const {
+    return left_iterator(find(lefts, left, compare_left), this);
+  }
+  right_iterator find_right(right_t const &right) const {
+    return right_iterator(find(sorted_rights, right, compare_right), this);
+  }
+
+  // Возвращает противоположный элемент по элементу
+  // Если элемента не существует -- бросает std::out_of_range
+  right_t const &at_left(left_t const &key) const {
+    std::size_t rank = find(lefts, key, compare_left);
+    if (rank == count) {
+      throw std::out_of_range("mapped_bimap::at_left - no such element");
+    }
+    return rights[rank];
+  }
+  left_t const &at_right(right_t const &key) const {
+    std::size_t rank = find(sorted_rights, key, compare_right);
+    if (rank == count) {
+      throw std::out_of_range("mapped_bimap::at_right - no such element");
+    }
+    return lefts[ranks[rank]];
+  }
+
+  // lower и upper bound'ы по каждой стороне
+  left_iterator lower_bound_left(left_t const &left) const {
+    return left_iterator(search(lefts, left, compare_left, true), this);
+  }
+  left_iterator upper_bound_left(left_t const &left) const {
+    return left_iterator(search(lefts, left, compare_left, false), this);
+  }
+
+  right_iterator lower_bound_right(right_t const &right) const {
+    return right_iterator(search(sorted_rights, right, compare_right, true), this);
+  }
+  right_iterator upper_bound_right(right_t const &right) const {
+    return right_iterator(search(sorted_rights, right, compare_right, false), this);
+  }
+
+  left_iterator begin_left() const {
+    return left_iterator(0, this);
+  }
+  left_iterator end_left() const {
+    return left_iterator(count, this);
+  }
+
+  right_iterator begin_right() const {
+    return right_iterator(0, this);
+  }
+  right_iterator end_right() const {
+    return right_iterator(count, this);
+  }
+
+  bool empty() const {
+    return count == 0;
+  }
+
+  std::size_t size() const {
+    return count;
+  }
+};
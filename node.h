@@ -1,19 +1,41 @@
 #pragma once
 
+#include <cstddef>
+#include <tuple>
 #include <utility>
 
 struct left_tag;
 struct right_tag;
 
-template <typename Tag, typename T>
-struct node {
+/**
+ * per node data of a tree policy that keeps none, takes no space as a base
+ */
+struct no_node_data {};
+
+template <typename Tag, typename T, typename Data = no_node_data>
+struct node : Data {
   explicit node(T &&value) : value(std::move(value)) {}
   explicit node(T const &value) : value(value) {}
+  // value is built right here from args, it is never moved
+  template <typename Tuple>
+  node(std::piecewise_construct_t, Tuple &&args)
+      : value(std::make_from_tuple<T>(std::forward<Tuple>(args))) {}
 
   ~node() = default;
 
+  static std::size_t size_of(node const *t) {
+    return t ? t->size : 0;
+  }
+
+  // has to be called after every change of children
+  void update_size() {
+    size = 1 + size_of(left) + size_of(right);
+  }
+
   T value;
   node *parent = nullptr;
   node *left = nullptr;
   node *right = nullptr;
+  // number of nodes in the subtree, kept up to date by every tree
+  std::size_t size = 1;
 };
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <iterator>
+#include <thread>
+#include <vector>
+
+/**
+ * Helpers of bulk bimap operations: plain std::threads, one per part of
+ * the work, no pool. Parts smaller than parallel_grain elements are not
+ * worth a thread.
+ */
+constexpr std::size_t parallel_grain = std::size_t(1) << 14;
+
+inline unsigned parallel_threads() {
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+/**
+ * number of parts for size elements on at most threads threads
+ */
+inline unsigned parallel_parts(std::size_t size, unsigned threads) {
+  return static_cast<unsigned>(std::max<std::size_t>(1, std::min<std::size_t>(threads, size / parallel_grain)));
+}
+
+/**
+ * calls f(i) for every i in [0, count), the calling thread takes i = 0;
+ * rethrows the first exception once all calls have finished
+ */
+template <typename F>
+void parallel_run(unsigned count, F const &f) {
+  std::vector<std::exception_ptr> errors(count);
+  auto guarded = [&](unsigned i) {
+    try {
+      f(i);
+    } catch (...) {
+      errors[i] = std::current_exception();
+    }
+  };
+
+  std::vector<std::thread> workers;
+  unsigned started = 1;
+  try {
+    workers.reserve(count);
+    for (; started < count; started++) {
+      workers.emplace_back(guarded, started);
+    }
+  } catch (...) {
+    // out of threads: the rest runs here
+  }
+  for (unsigned i = started; i < count; i++) {
+    guarded(i);
+  }
+  guarded(0);
+
+  for (std::thread &w : workers) {
+    w.join();
+  }
+  for (std::exception_ptr &e : errors) {
+    if (e) {
+      std::rethrow_exception(e);
+    }
+  }
+}
+
+/**
+ * sorts parts of [first, last) on their own threads, then merges
+ * neighbouring parts pairwise, the merges of one round run in parallel
+ */
+template <typename RandomIt, typename Compare>
+void parallel_sort(RandomIt first, RandomIt last, Compare const &compare, unsigned threads) {
+  std::size_t size = static_cast<std::size_t>(last - first);
+  unsigned parts = parallel_parts(size, threads);
+  if (parts == 1) {
+    std::sort(first, last, compare);
+    return;
+  }
+
+  std::vector<RandomIt> bounds(parts + 1);
+  for (unsigned i = 0; i <= parts; i++) {
+    bounds[i] = first + static_cast<std::ptrdiff_t>(size * i / parts);
+  }
+
+  parallel_run(parts, [&](unsigned i) { std::sort(bounds[i], bounds[i + 1], compare); });
+  for (unsigned width = 1; width < parts; width *= 2) {
+    parallel_run((parts + 2 * width - 1) / (2 * width), [&](unsigned i) {
+      unsigned lo = 2 * width * i;
+      unsigned mid = std::min(lo + width, parts);
+      unsigned hi = std::min(lo + 2 * width, parts);
+      std::inplace_merge(bounds[lo], bounds[mid], bounds[hi], compare);
+    });
+  }
+}
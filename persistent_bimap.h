@@ -0,0 +1,514 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "bimap.h"
+
+/**
+ * Persistent bimap: every side is an AVL tree of immutable, reference
+ * counted nodes. An update copies only the path from the root to the
+ * changed place, O(log n) new nodes, the rest is shared with older
+ * versions. So a copy (snapshot) is O(1) and is never affected by updates
+ * of the original.
+ *
+ * Reference counts are atomic: a snapshot can be read on any thread while
+ * the writer keeps updating its own copy. A single persistent_bimap object
+ * is not synchronized, same as std::shared_ptr.
+ */
+template <typename Left, typename Right,
+    typename CompareLeft = std::less<Left>, typename CompareRight = std::less<Right>>
+struct persistent_bimap {
+  using left_t = Left;
+  using right_t = Right;
+
+private:
+  /**
+   * node of the tree of Key, holds a copy of the opposite key
+   */
+  template <typename Key, typename Other>
+  struct node {
+    template <typename K, typename O>
+    node(K &&key, O &&other, node const *left, node const *right)
+        : key(std::forward<K>(key)), other(std::forward<O>(other)), left(left), right(right),
+          height(1 + std::max(height_of(left), height_of(right))) {}
+
+    Key key;
+    Other other;
+    node const *left;
+    node const *right;
+    int height;
+    mutable std::atomic<std::size_t> refs{1};
+  };
+
+  template <typename N>
+  static int height_of(N const *t) {
+    return t ? t->height : 0;
+  }
+
+  template <typename N>
+  static N const *retain(N const *t) {
+    if (t) {
+      t->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    return t;
+  }
+
+  template <typename N>
+  static void release(N const *t) {
+    // depth is O(log n), so is the recursion
+    if (t && t->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      release(t->left);
+      release(t->right);
+      delete t;
+    }
+  }
+
+  /**
+   * Path copying operations on trees of N. Arguments are borrowed, results
+   * are owned by the caller: a new node takes its own references to the
+   * children it shares.
+   */
+  template <typename N, typename Compare>
+  struct tree {
+    /**
+     * reference to an intermediate node, released unless taken, so a throwing
+     * make or new does not leak what is already built
+     */
+    struct owner {
+      explicit owner(N const *t) : t(t) {}
+      owner(owner const &) = delete;
+      owner &operator=(owner const &) = delete;
+      ~owner() {
+        release(t);
+      }
+
+      N const *take() {
+        return std::exchange(t, nullptr);
+      }
+
+      N const *t;
+    };
+
+    static N const *make(N const *from, N const *left, N const *right) {
+      N const *res = new N(from->key, from->other, left, right);
+      retain(left);
+      retain(right);
+      return res;
+    }
+
+    /**
+     * copy of from with children left and right, rotated if their heights
+     * differ by two
+     */
+    static N const *balance(N const *from, N const *left, N const *right) {
+      int diff = height_of(left) - height_of(right);
+
+      if (diff > 1) {
+        if (height_of(left->left) >= height_of(left->right)) {
+          owner r(make(from, left->right, right));
+          return make(left, left->left, r.t);
+        }
+        N const *mid = left->right;
+        owner l(make(left, left->left, mid->left));
+        owner r(make(from, mid->right, right));
+        return make(mid, l.t, r.t);
+      }
+
+      if (diff < -1) {
+        if (height_of(right->right) >= height_of(right->left)) {
+          owner l(make(from, left, right->left));
+          return make(right, l.t, right->right);
+        }
+        N const *mid = right->left;
+        owner l(make(from, left, mid->left));
+        owner r(make(right, mid->right, right->right));
+        return make(mid, l.t, r.t);
+      }
+
+      return make(from, left, right);
+    }
+
+    /**
+     * @return new root with a node of key added, key is absent in t
+     */
+    template <typename K, typename O>
+    static N const *insert(N const *t, K &&key, O &&other, Compare const &compare) {
+      if (!t) {
+        return new N(std::forward<K>(key), std::forward<O>(other), nullptr, nullptr);
+      }
+
+      bool to_left = compare(key, t->key);
+      owner child(insert(to_left ? t->left : t->right, std::forward<K>(key),
+                         std::forward<O>(other), compare));
+      return to_left ? balance(t, child.t, t->right) : balance(t, t->left, child.t);
+    }
+
+    /**
+     * @return new root without the node of key, key is present in t
+     */
+    template <typename K>
+    static N const *erase(N const *t, K const &key, Compare const &compare) {
+      if (compare(key, t->key)) {
+        owner child(erase(t->left, key, compare));
+        return balance(t, child.t, t->right);
+      }
+      if (compare(t->key, key)) {
+        owner child(erase(t->right, key, compare));
+        return balance(t, t->left, child.t);
+      }
+      if (!t->left || !t->right) {
+        return retain(t->left ? t->left : t->right);
+      }
+
+      // successor takes place of t
+      N const *s = t->right;
+      while (s->left) {
+        s = s->left;
+      }
+      owner child(erase_min(t->right));
+      return balance(s, t->left, child.t);
+    }
+
+    static N const *erase_min(N const *t) {
+      if (!t->left) {
+        return retain(t->right);
+      }
+
+      owner child(erase_min(t->left));
+      return balance(t, child.t, t->right);
+    }
+  };
+
+  using left_node = node<left_t, right_t>;
+  using right_node = node<right_t, left_t>;
+  using left_tree = tree<left_node, CompareLeft>;
+  using right_tree = tree<right_node, CompareRight>;
+
+  template <typename Tag>
+  using node_t = std::conditional_t<std::is_same_v<Tag, left_tag>, left_node, right_node>;
+
+  /**
+   * Forward iterator, keeps the path of nodes still to be visited. Stays
+   * valid as long as the version it was taken from is alive and unchanged.
+   */
+  template <typename Tag>
+  struct iterator {
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::conditional_t<std::is_same_v<Tag, left_tag>, left_t, right_t>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = value_type const *;
+    using reference = value_type const &;
+
+    reference operator*() const {
+      return path.back()->key;
+    }
+    pointer operator->() const {
+      return &path.back()->key;
+    }
+
+    iterator &operator++() {
+      node_t<Tag> const *t = path.back()->right;
+      path.pop_back();
+      descend_left(t);
+      return *this;
+    }
+    iterator operator++(int) {
+      iterator old = *this;
+      ++*this;
+
+      return old;
+    }
+
+    // Итератор на ту же пару с другой стороны, O(log n)
+    auto flip() const {
+      if constexpr (std::is_same_v<Tag, left_tag>) {
+        return path.empty() ? bmp->end_right() : bmp->find_right(path.back()->other);
+      } else {
+        return path.empty() ? bmp->end_left() : bmp->find_left(path.back()->other);
+      }
+    }
+
+    bool operator==(iterator const &other) const {
+      return (path.empty() ? nullptr : path.back()) == (other.path.empty() ? nullptr : other.path.back());
+    }
+    bool operator!=(iterator const &other) const {
+      return !(*this == other);
+    }
+
+  private:
+    friend persistent_bimap;
+
+    explicit iterator(persistent_bimap const *bmp) : bmp(bmp) {}
+
+    void descend_left(node_t<Tag> const *t) {
+      for (; t; t = t->left) {
+        path.push_back(t);
+      }
+    }
+
+    // ancestors of the current node which are visited after it, the current one is last
+    std::vector<node_t<Tag> const *> path;
+    persistent_bimap const *bmp;
+  };
+
+  template <typename Tag>
+  node_t<Tag> const *get_root() const {
+    if constexpr (std::is_same_v<Tag, left_tag>) {
+      return root_left;
+    } else {
+      return root_right;
+    }
+  }
+
+  template <typename Tag>
+  auto const &get_compare() const {
+    if constexpr (std::is_same_v<Tag, left_tag>) {
+      return compare_left;
+    } else {
+      return compare_right;
+    }
+  }
+
+  template <typename Tag, typename T>
+  node_t<Tag> const *find(T const &value) const {
+    auto const &compare = get_compare<Tag>();
+    node_t<Tag> const *t = get_root<Tag>();
+
+    while (t) {
+      if (compare(t->key, value)) {
+        t = t->right;
+      } else if (compare(value, t->key)) {
+        t = t->left;
+      } else {
+        return t;
+      }
+    }
+    return nullptr;
+  }
+
+  /**
+   * iterator on the first key for which go_right is false
+   */
+  template <typename Tag, typename GoRight>
+  iterator<Tag> bound(GoRight go_right) const {
+    iterator<Tag> res(this);
+    for (node_t<Tag> const *t = get_root<Tag>(); t;) {
+      if (go_right(t->key)) {
+        t = t->right;
+      } else {
+        res.path.push_back(t);
+        t = t->left;
+      }
+    }
+    return res;
+  }
+
+  template <typename Tag, typename T>
+  iterator<Tag> find_iterator(T const &value) const {
+    auto const &compare = get_compare<Tag>();
+    auto res = bound<Tag>([&](auto const &key) { return compare(key, value); });
+    if (!res.path.empty() && compare(value, res.path.back()->key)) {
+      res.path.clear();
+    }
+    return res;
+  }
+
+  template <typename L, typename R>
+  bool insert_unique(L &&left, R &&right) {
+    if (find<left_tag>(left) || find<right_tag>(right)) {
+      return false;
+    }
+
+    // the right tree first: if the left one throws, nothing has changed
+    right_node const *new_right = right_tree::insert(root_right, right, left, compare_right);
+    left_node const *new_left;
+    try {
+      new_left = left_tree::insert(root_left, std::forward<L>(left), std::forward<R>(right), compare_left);
+    } catch (...) {
+      release(new_right);
+      throw;
+    }
+
+    replace_roots(new_left, new_right);
+    count++;
+    return true;
+  }
+
+  void replace_roots(left_node const *new_left, right_node const *new_right) {
+    release(root_left);
+    release(root_right);
+    root_left = new_left;
+    root_right = new_right;
+  }
+
+  /**
+   * Persistent bimap fields
+   */
+  left_node const *root_left = nullptr;
+  right_node const *root_right = nullptr;
+  std::size_t count = 0;
+  CompareLeft compare_left;
+  CompareRight compare_right;
+
+public:
+  using left_iterator = iterator<left_tag>;
+  using right_iterator = iterator<right_tag>;
+
+  // Создает пустой persistent_bimap
+  explicit persistent_bimap(CompareLeft compare_left = CompareLeft(),
+                            CompareRight compare_right = CompareRight())
+      : compare_left(std::move(compare_left)), compare_right(std::move(compare_right)) {}
+
+  // Копирование за O(1): копия разделяет узлы с оригиналом и не видит
+  // его последующих изменений
+  persistent_bimap(persistent_bimap const &other)
+      : root_left(retain(other.root_left)), root_right(retain(other.root_right)), count(other.count),
+        compare_left(other.compare_left), compare_right(other.compare_right) {}
+
+  persistent_bimap(persistent_bimap &&other) noexcept
+      : root_left(std::exchange(other.root_left, nullptr)),
+        root_right(std::exchange(other.root_right, nullptr)),
+        count(std::exchange(other.count, 0)),
+        compare_left(std::move(other.compare_left)), compare_right(std::move(other.compare_right)) {}
+
+  persistent_bimap &operator=(persistent_bimap other) noexcept {
+    swap(other);
+    return *this;
+  }
+
+  ~persistent_bimap() {
+    release(root_left);
+    release(root_right);
+  }
+
+  void swap(persistent_bimap &other) noexcept {
+    using std::swap;
+
+    swap(root_left, other.root_left);
+    swap(root_right, other.root_right);
+    swap(count, other.count);
+    swap(compare_left, other.compare_left);
+    swap(compare_right, other.compare_right);
+  }
+
+  // Неизменяемая версия текущего состояния за O(1), ее можно читать из
+  // других потоков, пока этот объект изменяется
+  persistent_bimap snapshot() const {
+    return *this;
+  }
+
+  // Вставка пары (left, right), возвращает итератор на left.
+  // Если такой left или такой right уже присутствуют, вставка не
+  // производится и возвращается end_left().
+  // Создает O(log n) новых узлов, итераторы на эту версию инвалидируются.
+  left_iterator insert(left_t const &left, right_t const &right) {
+    return insert_unique(left, right) ? find_left(left) : end_left();
+  }
+  left_iterator insert(left_t &&left, right_t &&right) {
+    left_t key = left;
+    return insert_unique(std::move(left), std::move(right)) ? find_left(key) : end_left();
+  }
+
+  // Удаляет пару по ключу, возвращает была ли пара удалена.
+  bool erase_left(left_t const &left) {
+    left_node const *t = find<left_tag>(left);
+    if (!t) {
+      return false;
+    }
+
+    right_node const *new_right = right_tree::erase(root_right, t->other, compare_right);
+    left_node const *new_left;
+    try {
+      new_left = left_tree::erase(root_left, left, compare_left);
+    } catch (...) {
+      release(new_right);
+      throw;
+    }
+
+    replace_roots(new_left, new_right);
+    count--;
+    return true;
+  }
+  bool erase_right(right_t const &right) {
+    right_node const *t = find<right_tag>(right);
+    if (!t) {
+      return false;
+    }
+    // the key lives in the node, which the erase may free
+    left_t left = t->other;
+    return erase_left(left);
+  }
+
+  // Поиск элемента, возвращает итератор на него или end, если не нашел
+  left_iterator find_left(left_t const &left) const {
+    return find_iterator<left_tag>(left);
+  }
+  right_iterator find_right(right_t const &right) const {
+    return find_iterator<right_tag>(right);
+  }
+
+  // Возвращает противоположный элемент по элементу
+  // Если элемента не существует -- бросает std::out_of_range
+  right_t const &at_left(left_t const &key) const {
+    left_node const *t = find<left_tag>(key);
+    if (!t) {
+      throw std::out_of_range("persistent_bimap::at_left - no such element");
+    }
+    return t->other;
+  }
+  left_t const &at_right(right_t const &key) const {
+    right_node const *t = find<right_tag>(key);
+    if (!t) {
+      throw std::out_of_range("persistent_bimap::at_right - no such element");
+    }
+    return t->other;
+  }
+
+  // lower и upper bound'ы по каждой стороне
+  left_iterator lower_bound_left(left_t const &left) const {
+    return bound<left_tag>([&](left_t const &key) { return compare_left(key, left); });
+  }
+  left_iterator upper_bound_left(left_t const &left) const {
+    return bound<left_tag>([&](left_t const &key) { return !compare_left(left, key); });
+  }
+
+  right_iterator lower_bound_right(right_t const &right) const {
+    return bound<right_tag>([&](right_t const &key) { return compare_right(key, right); });
+  }
+  right_iterator upper_bound_right(right_t const &right) const {
+    return bound<right_tag>([&](right_t const &key) { return !compare_right(right, key); });
+  }
+
+  left_iterator begin_left() const {
+    left_iterator res(this);
+    res.descend_left(root_left);
+    return res;
+  }
+  left_iterator end_left() const {
+    return left_iterator(this);
+  }
+
+  right_iterator begin_right() const {
+    right_iterator res(this);
+    res.descend_left(root_right);
+    return res;
+  }
+  right_iterator end_right() const {
+    return right_iterator(this);
+  }
+
+  bool empty() const {
+    return count == 0;
+  }
+
+  std::size_t size() const {
+    return count;
+  }
+};
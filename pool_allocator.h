@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+/**
+ * Slab arena for tree nodes: blocks are cut from big slabs with a bump
+ * pointer and freed blocks go to a per-size free list, so insert/erase churn
+ * reuses memory instead of calling the global allocator.
+ * Not thread safe, like the bimap which owns it.
+ */
+struct node_pool {
+  explicit node_pool(std::size_t slab_size = 64 * 1024) : slab_size(slab_size) {}
+
+  node_pool(node_pool const &) = delete;
+  node_pool &operator=(node_pool const &) = delete;
+
+  ~node_pool() {
+    for (void *slab : slabs) {
+      ::operator delete(slab);
+    }
+  }
+
+  void *allocate(std::size_t bytes, std::size_t alignment) {
+    if (!pooled(bytes, alignment)) {
+      return ::operator new(bytes);
+    }
+
+    std::size_t cls = size_class(bytes);
+    if (cls >= free_lists.size()) {
+      free_lists.resize(cls + 1, nullptr);
+    }
+    if (free_lists[cls]) {
+      free_block *block = free_lists[cls];
+      free_lists[cls] = block->next;
+      return block;
+    }
+
+    std::size_t block_size = (cls + 1) * granularity;
+    if (static_cast<std::size_t>(end - cursor) < block_size) {
+      slabs.push_back(nullptr);
+      slabs.back() = ::operator new(slab_size);
+      cursor = static_cast<char *>(slabs.back());
+      end = cursor + slab_size;
+    }
+
+    void *res = cursor;
+    cursor += block_size;
+    return res;
+  }
+
+  void deallocate(void *p, std::size_t bytes, std::size_t alignment) noexcept {
+    if (!pooled(bytes, alignment)) {
+      ::operator delete(p);
+      return;
+    }
+
+    std::size_t cls = size_class(bytes);
+    free_lists[cls] = new (p) free_block{free_lists[cls]};
+  }
+
+private:
+  struct free_block {
+    free_block *next;
+  };
+
+  static constexpr std::size_t granularity = alignof(std::max_align_t);
+
+  static std::size_t size_class(std::size_t bytes) {
+    return (bytes + granularity - 1) / granularity - 1;
+  }
+
+  bool pooled(std::size_t bytes, std::size_t alignment) const {
+    return alignment <= granularity && bytes <= slab_size / 8;
+  }
+
+  std::size_t slab_size;
+  std::vector<void *> slabs;
+  std::vector<free_block *> free_lists;
+  char *cursor = nullptr;
+  char *end = nullptr;
+};
+
+/**
+ * Allocator over a shared node_pool. Single objects come from the pool,
+ * arrays go straight to the global allocator. Copies and rebinds share the
+ * pool, but a copied container gets a fresh one, so copies of a bimap never
+ * share memory.
+ */
+template <typename T>
+struct pool_allocator {
+  using value_type = T;
+
+  using propagate_on_container_copy_assignment = std::true_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+
+  pool_allocator() : pool(std::make_shared<node_pool>()) {}
+
+  // Moves copy the pool pointer: a moved-from allocator must stay equal to
+  // its old value and keep serving the container it belongs to.
+  pool_allocator(pool_allocator const &other) noexcept = default;
+  pool_allocator(pool_allocator &&other) noexcept : pool(other.pool) {}
+  pool_allocator &operator=(pool_allocator const &other) noexcept = default;
+  pool_allocator &operator=(pool_allocator &&other) noexcept {
+    pool = other.pool;
+    return *this;
+  }
+
+  template <typename U>
+  pool_allocator(pool_allocator<U> const &other) noexcept : pool(other.pool) {}
+
+  T *allocate(std::size_t n) {
+    if (n != 1) {
+      return static_cast<T *>(::operator new(n * sizeof(T)));
+    }
+    return static_cast<T *>(pool->allocate(sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T *p, std::size_t n) noexcept {
+    if (n != 1) {
+      ::operator delete(p);
+      return;
+    }
+    pool->deallocate(p, sizeof(T), alignof(T));
+  }
+
+  pool_allocator select_on_container_copy_construction() const {
+    return pool_allocator();
+  }
+
+  template <typename U>
+  bool operator==(pool_allocator<U> const &other) const {
+    return pool == other.pool;
+  }
+  template <typename U>
+  bool operator!=(pool_allocator<U> const &other) const {
+    return pool != other.pool;
+  }
+
+private:
+  template <typename U>
+  friend struct pool_allocator;
+
+  std::shared_ptr<node_pool> pool;
+};
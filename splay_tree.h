@@ -1,38 +1,43 @@
 #pragma once
 
 #include "node.h"
-template <typename Left, typename Right>
+template <typename Left, typename Right, typename Data = no_node_data>
 struct splay_tree;
 
-template <typename Tag, typename Left, typename Right, typename T>
-static splay_tree<Left, Right> *get_splay(node<Tag, T> *t) {
-  return static_cast<splay_tree<Left, Right>*>(t);
+template <typename Tag, typename Left, typename Right, typename T, typename Data>
+static splay_tree<Left, Right, Data> *get_splay(node<Tag, T, Data> *t) {
+  return static_cast<splay_tree<Left, Right, Data>*>(t);
 }
 
-template <typename Tag, typename Left, typename Right, typename T>
-static node<Tag, T> *get_node(splay_tree<Left, Right> *t) {
-  return static_cast<node<Tag, T>*>(t);
+template <typename Tag, typename Left, typename Right, typename T, typename Data>
+static node<Tag, T, Data> *get_node(splay_tree<Left, Right, Data> *t) {
+  return static_cast<node<Tag, T, Data>*>(t);
 }
 
-template <typename Left, typename Right>
-struct splay_tree : node<left_tag, Left>, node<right_tag, Right> {
+template <typename Left, typename Right, typename Data>
+struct splay_tree : node<left_tag, Left, Data>, node<right_tag, Right, Data> {
   using left_t = Left;
   using right_t = Right;
 
   splay_tree() = default;
 
   splay_tree(splay_tree const &other)
-      : node<left_tag, left_t>(get_node<left_tag, right_t>(&other)->value),
-        node<right_tag, right_t>(get_node<right_tag, left_t>(&other)->value) {}
+      : node<left_tag, left_t, Data>(static_cast<node<left_tag, left_t, Data> const &>(other).value),
+        node<right_tag, right_t, Data>(static_cast<node<right_tag, right_t, Data> const &>(other).value) {}
 
   splay_tree(left_t &&first_value, right_t &&second_value)
-      : node<left_tag, left_t>(std::move(first_value)), node<right_tag, right_t>(std::move(second_value)) {}
+      : node<left_tag, left_t, Data>(std::move(first_value)), node<right_tag, right_t, Data>(std::move(second_value)) {}
   splay_tree(left_t const &first_value, right_t &&second_value)
-      : node<left_tag, left_t>(first_value), node<right_tag, right_t>(std::move(second_value)) {}
+      : node<left_tag, left_t, Data>(first_value), node<right_tag, right_t, Data>(std::move(second_value)) {}
   splay_tree(left_t &&first_value, right_t const &second_value)
-      : node<left_tag, left_t>(std::move(first_value)), node<right_tag, right_t>(second_value) {}
+      : node<left_tag, left_t, Data>(std::move(first_value)), node<right_tag, right_t, Data>(second_value) {}
   splay_tree(left_t const &first_value, right_t const &second_value)
-      : node<left_tag, left_t>(first_value), node<right_tag, right_t>(second_value) {}
+      : node<left_tag, left_t, Data>(first_value), node<right_tag, right_t, Data>(second_value) {}
+
+  template <typename LeftArgs, typename RightArgs>
+  splay_tree(std::piecewise_construct_t, LeftArgs &&left_args, RightArgs &&right_args)
+      : node<left_tag, left_t, Data>(std::piecewise_construct, std::forward<LeftArgs>(left_args)),
+        node<right_tag, right_t, Data>(std::piecewise_construct, std::forward<RightArgs>(right_args)) {}
 
   ~splay_tree() = default;
 };
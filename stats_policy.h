@@ -0,0 +1,156 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+
+/**
+ * Instrumentation policies of bimap (the Stats parameter).
+ * no_stats: hooks are empty, the counters compile to nothing.
+ * counting_stats: counts operations, zig rotations and comparator calls of
+ * each side and keeps histograms of the depth searches reach.
+ * The default is no_stats; counting_stats has to be chosen explicitly, so
+ * bimap<L, R> names the same type in every translation unit.
+ */
+
+// Счетчики одной стороны bimap (см. bimap::stats).
+struct bimap_side_stats {
+  static constexpr std::size_t depth_buckets = 32;
+
+  // Номер корзины гистограммы для глубины depth: 0 для корня,
+  // k для глубин [2^(k-1), 2^k), последняя корзина -- все большие.
+  static std::size_t depth_bucket(std::size_t depth) {
+    std::size_t res = 0;
+    for (; depth != 0 && res + 1 < depth_buckets; depth >>= 1) {
+      res++;
+    }
+    return res;
+  }
+
+  // Точные поиски: find, at, удаление по ключу и т.п.
+  std::uint64_t finds = 0;
+  std::uint64_t erases = 0;
+  std::uint64_t bounds = 0;
+  // zig повороты splay дерева, у сбалансированных деревьев их нет
+  std::uint64_t zigs = 0;
+  std::uint64_t comparisons = 0;
+  // Глубина узла (в ребрах от корня, до splay), на котором остановился
+  // поиск по дереву, и узла, к которому перешел ++ или -- итератора.
+  std::uint64_t find_depth[depth_buckets] = {};
+  std::uint64_t step_depth[depth_buckets] = {};
+  // Текущая высота дерева в узлах, 0 для пустого.
+  std::size_t height = 0;
+};
+
+struct bimap_stats {
+  // Попытки вставить одну пару, удачные и нет.
+  std::uint64_t inserts = 0;
+  bimap_side_stats left;
+  bimap_side_stats right;
+};
+
+struct no_stats {
+  static constexpr bool enabled = false;
+
+  void insert() {}
+  void find(std::size_t) {}
+  void erase(std::size_t, std::size_t = 1) {}
+  void bound(std::size_t) {}
+  void zig(std::size_t) {}
+  void compare(std::size_t) {}
+  void find_depth(std::size_t, std::size_t) {}
+  void step_depth(std::size_t, std::size_t) {}
+
+  bimap_stats snapshot() const {
+    return {};
+  }
+  void reset() {}
+};
+
+/**
+ * Counters are bumped by a relaxed load and store, not a locked increment:
+ * readers of a const_view on several threads may lose counts but never
+ * race, and a single thread pays no more than for a plain variable
+ */
+struct counting_stats {
+  static constexpr bool enabled = true;
+
+  void insert() {
+    add(inserts);
+  }
+  void find(std::size_t side) {
+    add(sides[side].finds);
+  }
+  void erase(std::size_t side, std::size_t count = 1) {
+    add(sides[side].erases, count);
+  }
+  void bound(std::size_t side) {
+    add(sides[side].bounds);
+  }
+  void zig(std::size_t side) {
+    add(sides[side].zigs);
+  }
+  void compare(std::size_t side) {
+    add(sides[side].comparisons);
+  }
+  void find_depth(std::size_t side, std::size_t depth) {
+    add(sides[side].find_depth[bimap_side_stats::depth_bucket(depth)]);
+  }
+  void step_depth(std::size_t side, std::size_t depth) {
+    add(sides[side].step_depth[bimap_side_stats::depth_bucket(depth)]);
+  }
+
+  bimap_stats snapshot() const {
+    bimap_stats res;
+    res.inserts = inserts.load(std::memory_order_relaxed);
+    copy(sides[0], res.left);
+    copy(sides[1], res.right);
+    return res;
+  }
+
+  void reset() {
+    inserts.store(0, std::memory_order_relaxed);
+    for (side &s : sides) {
+      for (counter *c : {&s.finds, &s.erases, &s.bounds, &s.zigs, &s.comparisons}) {
+        c->store(0, std::memory_order_relaxed);
+      }
+      for (std::size_t i = 0; i < bimap_side_stats::depth_buckets; i++) {
+        s.find_depth[i].store(0, std::memory_order_relaxed);
+        s.step_depth[i].store(0, std::memory_order_relaxed);
+      }
+    }
+  }
+
+private:
+  using counter = std::atomic<std::uint64_t>;
+
+  struct side {
+    counter finds{0};
+    counter erases{0};
+    counter bounds{0};
+    counter zigs{0};
+    counter comparisons{0};
+    counter find_depth[bimap_side_stats::depth_buckets] = {};
+    counter step_depth[bimap_side_stats::depth_buckets] = {};
+  };
+
+  static void add(counter &c, std::uint64_t n = 1) {
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  static void copy(side const &from, bimap_side_stats &to) {
+    to.finds = from.finds.load(std::memory_order_relaxed);
+    to.erases = from.erases.load(std::memory_order_relaxed);
+    to.bounds = from.bounds.load(std::memory_order_relaxed);
+    to.zigs = from.zigs.load(std::memory_order_relaxed);
+    to.comparisons = from.comparisons.load(std::memory_order_relaxed);
+    for (std::size_t i = 0; i < bimap_side_stats::depth_buckets; i++) {
+      to.find_depth[i] = from.find_depth[i].load(std::memory_order_relaxed);
+      to.step_depth[i] = from.step_depth[i].load(std::memory_order_relaxed);
+    }
+  }
+
+  counter inserts{0};
+  side sides[2];
+};
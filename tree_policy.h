@@ -0,0 +1,176 @@
+#pragma once
+
+#include <algorithm>
+#include "node.h"
+
+/**
+ * Tree policies of bimap.
+ * splay_policy: every access splays the node to the root, good for skewed
+ * access, but reads restructure the trees and bounds are amortized.
+ * avl_policy: AVL trees, lookups never write and every operation is
+ * O(log n) in the worst case.
+ */
+struct splay_policy {
+  static constexpr bool self_adjusting = true;
+
+  using node_data = no_node_data;
+
+  /**
+   * restores data of t from its children, splay nodes keep only the size
+   */
+  template <typename N>
+  static void update(N *t) {
+    t->update_size();
+  }
+};
+
+struct avl_policy {
+  static constexpr bool self_adjusting = false;
+
+  /**
+   * height of the subtree, only AVL nodes carry it
+   */
+  struct node_data {
+    int height = 1;
+  };
+
+  /**
+   * links leaf t as a child of parent (as root if parent is nullptr)
+   * and restores balance up to the root
+   */
+  template <typename N>
+  static void link(N *&root, N *parent, N *t, bool to_right) {
+    t->parent = parent;
+    t->left = t->right = nullptr;
+    t->height = 1;
+    t->size = 1;
+
+    if (!parent) {
+      root = t;
+      return;
+    }
+
+    (to_right ? parent->right : parent->left) = t;
+    rebalance(root, parent);
+  }
+
+  /**
+   * removes t from the tree with given root, t stays allocated
+   */
+  template <typename N>
+  static void unlink(N *&root, N *t) {
+    N *from = t->parent;
+
+    if (t->left && t->right) {
+      // successor takes place of t
+      N *s = t->right;
+      while (s->left) {
+        s = s->left;
+      }
+
+      if (s->parent != t) {
+        from = s->parent;
+        from->left = s->right;
+        if (s->right) {
+          s->right->parent = from;
+        }
+        s->right = t->right;
+        s->right->parent = s;
+      } else {
+        from = s;
+      }
+
+      s->left = t->left;
+      s->left->parent = s;
+      s->height = t->height;
+      replace(root, t, s);
+    } else {
+      N *child = t->left ? t->left : t->right;
+      replace(root, t, child);
+    }
+
+    rebalance(root, from);
+  }
+
+  template <typename N>
+  static int height(N const *t) {
+    return t ? t->height : 0;
+  }
+
+  template <typename N>
+  static void update(N *t) {
+    t->height = 1 + std::max(height(t->left), height(t->right));
+    t->update_size();
+  }
+
+private:
+  /**
+   * puts by (may be nullptr) on the place of t in t's parent
+   */
+  template <typename N>
+  static void replace(N *&root, N *t, N *by) {
+    if (by) {
+      by->parent = t->parent;
+    }
+
+    if (!t->parent) {
+      root = by;
+    } else if (t->parent->left == t) {
+      t->parent->left = by;
+    } else {
+      t->parent->right = by;
+    }
+  }
+
+  /**
+   * lifts c over its parent
+   */
+  template <typename N>
+  static void rotate_up(N *&root, N *c) {
+    N *p = c->parent;
+
+    if (p->left == c) {
+      p->left = c->right;
+      if (c->right) {
+        c->right->parent = p;
+      }
+      c->right = p;
+    } else {
+      p->right = c->left;
+      if (c->left) {
+        c->left->parent = p;
+      }
+      c->left = p;
+    }
+
+    replace(root, p, c);
+    p->parent = c;
+
+    update(p);
+    update(c);
+  }
+
+  template <typename N>
+  static void rebalance(N *&root, N *t) {
+    while (t) {
+      update(t);
+      int balance = height(t->left) - height(t->right);
+
+      if (balance > 1) {
+        if (height(t->left->left) < height(t->left->right)) {
+          rotate_up(root, t->left->right);
+        }
+        rotate_up(root, t->left);
+        t = t->parent;
+      } else if (balance < -1) {
+        if (height(t->right->right) < height(t->right->left)) {
+          rotate_up(root, t->right->left);
+        }
+        rotate_up(root, t->right);
+        t = t->parent;
+      }
+
+      t = t->parent;
+    }
+  }
+};